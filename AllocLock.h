@@ -0,0 +1,294 @@
+#pragma once
+
+/* 内存池中用到的锁
+   PageMutex是pc的_pageMtx，BucketMutex是cc每个桶的SpanList::_mtx，PoolMutex是ObjectPool::_poolMtx
+   底层用哪种锁由ALLOC_LOCK决定，默认是先自旋再睡眠的AdaptiveLock，
+   编译时加上 -DALLOC_LOCK=std::mutex 可以换回标准库的锁做对比
+   编译时加上 -DLOCK_STATS=1 之后，每把锁都会统计获取次数、发生竞争的次数、等待时间和持有时间的分布，
+   同一类锁的数据记在一起，通过GetLockStats读取
+*/
+
+#include <cstdio>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#ifdef __linux__
+    #include <unistd.h>
+    #include <sys/syscall.h>
+    #include <linux/futex.h>
+#endif
+#ifdef _MSC_VER
+    #include <intrin.h>     // _mm_pause
+#endif
+
+#ifndef LOCK_STATS
+    #define LOCK_STATS 0
+#endif
+
+#ifndef ALLOC_LOCK
+    #define ALLOC_LOCK AdaptiveLock
+#endif
+
+// 自旋等待时告诉CPU正在忙等，让出流水线资源给同一个核上的另一个超线程
+static inline void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#elif defined(_M_X64) || defined(_M_IX86)
+    _mm_pause();
+#endif
+}
+
+/* 先自旋再睡眠的锁
+   内存池的临界区大多只有几十到几百ns，锁被占用时先用test-and-test-and-set自旋，
+   每次没拿到就把等待的pause次数翻倍，自旋超过ADAPTIVE_SPIN_MAX次pause还没拿到，
+   说明持有者可能在做系统调用或者被换出去了，再用futex睡眠，不白白占着CPU
+   _state：0表示没有上锁，1表示上锁了且没有线程在睡眠，2表示上锁了且可能有线程在睡眠
+*/
+class AdaptiveLock
+{
+public:
+    void lock()
+    {
+        if (try_lock())
+        {
+            return;
+        }
+
+        // 自旋阶段，指数退避
+        for (size_t pause = 1; pause <= SpinMax(); pause <<= 1)
+        {
+            for (size_t i = 0; i < pause; ++i)
+            {
+                CpuRelax();
+            }
+
+            // 先读一下，锁被占用时不去抢，避免缓存行在各个核之间来回传递
+            if (_state.load(std::memory_order_relaxed) == 0 && try_lock())
+            {
+                return;
+            }
+        }
+
+        // 睡眠阶段，把状态改成2，解锁的线程看到2就会来唤醒
+        while (_state.exchange(2, std::memory_order_acquire) != 0)
+        {
+            Wait();
+        }
+    }
+
+    bool try_lock()
+    {
+        uint32_t expected = 0;
+        return _state.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void unlock()
+    {
+        if (_state.exchange(0, std::memory_order_release) == 2)
+        {
+            Wake();
+        }
+    }
+
+private:
+    static const size_t ADAPTIVE_SPIN_MAX = 128;
+
+    // 只有一个核的时候持有者不可能同时在跑，自旋没有意义，直接睡眠
+    static size_t SpinMax()
+    {
+        static const size_t spinMax = std::thread::hardware_concurrency() > 1 ? ADAPTIVE_SPIN_MAX : 0;
+        return spinMax;
+    }
+
+    // _state还是2的时候睡眠，直到被唤醒
+    void Wait()
+    {
+#ifdef __linux__
+        syscall(SYS_futex, (uint32_t*)&_state, FUTEX_WAIT_PRIVATE, 2, nullptr, nullptr, 0);
+#else
+        std::this_thread::yield();  // 没有futex的平台让出CPU之后再抢
+#endif
+    }
+
+    // 唤醒一个睡眠的线程
+    void Wake()
+    {
+#ifdef __linux__
+        syscall(SYS_futex, (uint32_t*)&_state, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+    }
+
+    std::atomic<uint32_t> _state{ 0 };
+};
+
+// 锁的种类
+enum LockKind
+{
+    LOCK_PAGE,      // PageCache::_pageMtx
+    LOCK_BUCKET,    // CentralCache中每个桶的锁
+    LOCK_POOL,      // ObjectPool::_poolMtx
+    LOCK_KIND_NUM
+};
+
+static const size_t LOCK_HIST_NUM = 24;     // 时间分布的格数，第i格是[2^i, 2^(i+1)) ns，最后一格包括更长的
+
+// 一类锁的统计数据
+struct LockStats
+{
+    std::atomic<size_t> _acquires;      // 获取了多少次
+    std::atomic<size_t> _contended;     // 其中有多少次锁已经被别人持有，需要等
+    std::atomic<size_t> _waitNs;        // 等待的总时间
+    std::atomic<size_t> _holdNs;        // 持有的总时间
+    std::atomic<size_t> _waitHist[LOCK_HIST_NUM];   // 发生竞争时等待时间的分布
+    std::atomic<size_t> _holdHist[LOCK_HIST_NUM];   // 持有时间的分布
+};
+
+// 所有锁的统计数据，静态存储区的atomic初始都是0
+static LockStats s_lockStats[LOCK_KIND_NUM];
+
+static inline LockStats& GetLockStats(LockKind kind)
+{
+    return s_lockStats[kind];
+}
+
+// 清空统计数据，benchmark每一段开始前调用
+static inline void ResetLockStats()
+{
+    for (size_t k = 0; k < LOCK_KIND_NUM; ++k)
+    {
+        LockStats& stats = s_lockStats[k];
+        stats._acquires = stats._contended = stats._waitNs = stats._holdNs = 0;
+        for (size_t i = 0; i < LOCK_HIST_NUM; ++i)
+        {
+            stats._waitHist[i] = stats._holdHist[i] = 0;
+        }
+    }
+}
+
+// 时间ns落在分布的哪一格
+static inline size_t LockHistIndex(size_t ns)
+{
+    size_t i = 0;
+    while (ns > 1 && i < LOCK_HIST_NUM - 1)
+    {
+        ns >>= 1;
+        ++i;
+    }
+    return i;
+}
+
+// 从分布中估计第p(0~1)分位数，返回所在格子的上界，单位ns
+static inline size_t LockHistPercentile(const std::atomic<size_t>* hist, double p)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < LOCK_HIST_NUM; ++i)
+    {
+        total += hist[i].load(std::memory_order_relaxed);
+    }
+
+    size_t target = (size_t)(total * p), sum = 0;
+    for (size_t i = 0; i < LOCK_HIST_NUM; ++i)
+    {
+        sum += hist[i].load(std::memory_order_relaxed);
+        if (sum > target)
+        {
+            return (size_t)2 << i;
+        }
+    }
+    return 0;
+}
+
+// 打印所有锁的统计数据
+static inline void PrintLockStats(FILE* fp = stdout)
+{
+    static const char* names[LOCK_KIND_NUM] = { "page", "bucket", "pool" };
+
+    for (size_t k = 0; k < LOCK_KIND_NUM; ++k)
+    {
+        LockStats& stats = s_lockStats[k];
+        size_t acquires = stats._acquires.load(), contended = stats._contended.load();
+        if (acquires == 0)
+        {
+            continue;
+        }
+
+        fprintf(fp, "%-6s 获取%zu次，竞争%zu次(%.2f%%)，平均等待%zu ns，等待p99 %zu ns，平均持有%zu ns，持有p99 %zu ns\n",
+            names[k], acquires, contended, 100.0 * contended / acquires,
+            contended ? stats._waitNs.load() / contended : 0, LockHistPercentile(stats._waitHist, 0.99),
+            stats._holdNs.load() / acquires, LockHistPercentile(stats._holdHist, 0.99));
+    }
+}
+
+/* 给锁加上统计，接口和Lock一样，可以直接用在lock_guard/unique_lock中
+   Kind决定数据记到哪一类中
+*/
+template<class Lock, LockKind Kind>
+class InstrumentedLock
+{
+public:
+    void lock()
+    {
+        LockStats& stats = s_lockStats[Kind];
+
+        if (!_lock.try_lock())
+        {// 没拿到，说明发生了竞争，计一下等了多久
+            auto begin = std::chrono::steady_clock::now();
+            _lock.lock();
+            size_t ns = ElapsedNs(begin);
+
+            stats._contended.fetch_add(1, std::memory_order_relaxed);
+            stats._waitNs.fetch_add(ns, std::memory_order_relaxed);
+            stats._waitHist[LockHistIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        stats._acquires.fetch_add(1, std::memory_order_relaxed);
+        _lockedAt = std::chrono::steady_clock::now();   // 持有锁的线程才会读写它
+    }
+
+    bool try_lock()
+    {
+        if (!_lock.try_lock())
+        {
+            return false;
+        }
+
+        s_lockStats[Kind]._acquires.fetch_add(1, std::memory_order_relaxed);
+        _lockedAt = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    void unlock()
+    {
+        size_t ns = ElapsedNs(_lockedAt);
+        _lock.unlock();
+
+        LockStats& stats = s_lockStats[Kind];
+        stats._holdNs.fetch_add(ns, std::memory_order_relaxed);
+        stats._holdHist[LockHistIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    static size_t ElapsedNs(std::chrono::steady_clock::time_point begin)
+    {
+        return (size_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - begin).count();
+    }
+
+    Lock _lock;
+    std::chrono::steady_clock::time_point _lockedAt;
+};
+
+#if LOCK_STATS
+    typedef InstrumentedLock<ALLOC_LOCK, LOCK_PAGE> PageMutex;
+    typedef InstrumentedLock<ALLOC_LOCK, LOCK_BUCKET> BucketMutex;
+    typedef InstrumentedLock<ALLOC_LOCK, LOCK_POOL> PoolMutex;
+#else
+    typedef ALLOC_LOCK PageMutex;
+    typedef ALLOC_LOCK BucketMutex;
+    typedef ALLOC_LOCK PoolMutex;
+#endif
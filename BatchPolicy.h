@@ -0,0 +1,82 @@
+#pragma once
+#include "Common.h"
+
+/* tc和cc之间批量移动块的策略
+   FetchNum：tc的某个桶空了，决定这次从cc取多少块
+   FlushNum：桶中的块数到了高水位(BatchState::_highWater)，决定还给cc多少块
+   两个函数都可以顺便调整BatchState，moveNum是这个桶单次批量移动的上限(SizeClass::NumMoveSize)
+   用哪种策略由BATCH_POLICY决定，默认是AdaptiveBatchPolicy，
+   编译时加上 -DBATCH_POLICY=SlowStartBatchPolicy 可以换回原来的慢开始做对比
+*/
+
+#ifndef BATCH_POLICY
+    #define BATCH_POLICY AdaptiveBatchPolicy
+#endif
+
+/* 原来的慢开始：每次取块之后_maxSize加1，直到桶的上限，之后不再变化
+   块数到了_maxSize就把_maxSize块全部还回去 */
+struct SlowStartBatchPolicy
+{
+    static size_t FetchNum(BatchState& state, size_t moveNum)
+    {
+        size_t batchNum = std::min(state._maxSize, moveNum);
+        if (batchNum == state._maxSize)
+        {// 如果没有达到上限，那下次再申请这块空间的时候，可以多申请一块
+            ++state._maxSize;
+        }
+        state._highWater = state._maxSize;
+        return batchNum;
+    }
+
+    static size_t FlushNum(BatchState& state, size_t size, size_t /* moveNum */)
+    {
+        return std::min(state._maxSize, size);
+    }
+};
+
+static const size_t BATCH_DECAY_OVERFLOWS = 2;  // 连续几次还给cc，_maxSize减半一次
+
+/* 自适应批量：
+   1. 连续两次桶空了才去cc取，说明线程在大量申请，_maxSize翻倍，几次就能到桶的上限；
+      取和还交替出现的稳定负载下_maxSize只加1，和慢开始一样
+   2. 取块之后低水位是_maxSize的一半，高水位再多一个桶的上限，
+      到了高水位只还到低水位，手里留一些块，后面的申请不用马上又去cc取，
+      每次至少还一个桶上限的块，释放得再多加锁次数也不会变多
+   3. 连续还给cc说明线程只在释放，低水位逐次减半，_maxSize每BATCH_DECAY_OVERFLOWS次减半，
+      线程的需求下降之后缓存的块也跟着变少
+*/
+struct AdaptiveBatchPolicy
+{
+    static size_t FetchNum(BatchState& state, size_t moveNum)
+    {
+        size_t batchNum = std::min(state._maxSize, moveNum);
+        if (state._maxSize < moveNum)
+        {
+            state._maxSize = std::min(state._misses > 0 ? state._maxSize * 2 : state._maxSize + 1, moveNum);
+        }
+        ++state._misses;
+        state._overflows = 0;
+
+        state._lowWater = state._maxSize / 2;
+        state._highWater = state._lowWater + moveNum;
+        return batchNum;
+    }
+
+    static size_t FlushNum(BatchState& state, size_t size, size_t moveNum)
+    {
+        state._misses = 0;
+        if (++state._overflows > 1)
+        {
+            state._lowWater /= 2;
+        }
+        if (state._overflows % BATCH_DECAY_OVERFLOWS == 0 && state._maxSize > 1)
+        {
+            state._maxSize /= 2;
+        }
+
+        size_t keep = std::min(state._lowWater, size - 1);
+        state._lowWater = keep;
+        state._highWater = keep + moveNum;
+        return size - keep;
+    }
+};
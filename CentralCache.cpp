@@ -2,9 +2,30 @@
 #include "PageCache.h"
 
 CentralCache CentralCache::_sInst;  // CentralCache的饿汉对象
+std::atomic<CentralCache*> CentralCache::_tagInsts[TAG_NUM] = {};
 
+// 创建tag标签的cc，一个标签只会创建一次，之后一直存在
+CentralCache* CentralCache::GetTagInstance(size_t tag)
+{
+    assert(tag > 0 && tag < TAG_NUM);
+
+    CentralCache* inst = _tagInsts[tag].load(std::memory_order_acquire);
+    if (inst == nullptr)
+    {
+        static std::mutex mtx;
+        std::lock_guard<std::mutex> lock(mtx);
+        inst = _tagInsts[tag].load(std::memory_order_relaxed);
+        if (inst == nullptr)
+        {// cc很大，不放在静态存储区里，用到的标签才直接向系统申请
+            size_t kpage = SizeClass::_RoundUp(sizeof(CentralCache), 1 << PAGE_SHIFT) >> PAGE_SHIFT;
+            inst = new (SystemAlloc(kpage)) CentralCache(tag);
+            _tagInsts[tag].store(inst, std::memory_order_release);
+        }
+    }
+    return inst;
+}
 
-size_t CentralCache::FetchRangeObj(void*& start, void*& end, size_t batchNum, size_t size)
+size_t CentralCache::FetchRangeObj(void*& start, void*& end, size_t batchNum, size_t size, ThreadCache* owner)
 {
     // 获取到size对应哪一个SpanList
     size_t index = SizeClass::Index(size);
@@ -12,103 +33,330 @@ size_t CentralCache::FetchRangeObj(void*& start, void*& end, size_t batchNum, si
     // 对cc中的SpanList操作时需要加锁
     _spanLists[index]._mtx.lock();
 
-    // 获取到一个管理空间非空的span
-    Span* span = GetOneSpan(_spanLists[index], size);
-    assert(span);   // 断言一下不为空
-    assert(span->_freeList);    // 断言一下span管理的空间不为空
+    start = end = nullptr;
+    size_t actualNum = 0;   // 函数实际的返回值
 
-    // 起初都指向_freeList, 让end不断往后走
-    start = end = span->_freeList;
-    size_t actualNum = 1;   // 函数实际的返回值
-
-    // 在end的next不为空的前提下，让end走batchNum - 1步
-    size_t i = 0;
-    while (i < batchNum - 1 && ObjNext(end) != nullptr)
+    /* 按占用率从高到低依次从span中取块，直到凑够batchNum块或者没有非空span为止
+       这样快满的span会被优先用满，快空的span才有机会全部还回来交给pc */
+    while (actualNum < batchNum)
     {
-        end = ObjNext(end);
-        ++actualNum;    // 记录end走了多少步
-        ++i;
-    }
+        // 第一次一定要拿到一个非空span，后面只在现有的span中凑
+        Span* span = actualNum == 0 ? GetOneSpan(index, size) : FindFullestSpan(index);
+        if (span == nullptr)
+        {
+            break;
+        }
+        assert(span->_freeList);    // 断言一下span管理的空间不为空
 
-    // 将[start, end]返回给ThreadCache后，调整Span的_freeList
-    span->_freeList = ObjNext(end);
-    span->_usecount += actualNum;   // 给tc分了多少就给_usecount加多少
-    ObjNext(end) = nullptr; // 返回一段空间，不要和原先Span的_freeList中的块相连
+        // 起初都指向_freeList, 让last不断往后走
+        void* first = span->_freeList;
+        void* last = first;
+        size_t n = 1;
+
+        // 在last的next不为空的前提下，让last最多走到凑够batchNum块
+        while (actualNum + n < batchNum && ObjNext(last) != nullptr)
+        {
+            last = ObjNext(last);
+            ++n;    // 记录last走了多少步
+        }
 
+        // 将[first, last]取出后，调整Span的_freeList
+        span->_freeList = ObjNext(last);
+        span->_usecount += n;   // 给tc分了多少就给_usecount加多少
+        ObjNext(last) = nullptr; // 返回一段空间，不要和原先Span的_freeList中的块相连
+
+        /* tc归还的块是头插回来的，给出去之前按地址排好序，让线程拿到的块尽量连续
+           只排取出来的这最多batchNum块，不在桶锁里把整个span的自由链表都排一遍 */
+        if (!span->_sorted)
+        {
+            first = SortObjList(first);
+            for (last = first; ObjNext(last) != nullptr; last = ObjNext(last))
+            {}
+        }
+        if (span->_freeList == nullptr)
+        {// 取空了，之后还回来的第一块又是有序的起点
+            span->_sorted = true;
+        }
+        span->_owner.store(owner, std::memory_order_relaxed);
+
+        // 接到[start, end]后面
+        if (start == nullptr)
+        {
+            start = first;
+        }
+        else
+        {
+            ObjNext(end) = first;
+        }
+        end = last;
+        actualNum += n;
+
+        AdjustSpan(index, span);
+    }
 
     _spanLists[index]._mtx.unlock();
 
     return actualNum;
 }
 
-// 获取一个管理空间的非空Span
-Span* CentralCache::GetOneSpan(SpanList& list, size_t size)
+// 在index桶中找到占用率最高且还有空闲块的span
+Span* CentralCache::FindFullestSpan(size_t index)
 {
-    // 先在cc中找一下有没有管理空间非空的span
-    Span* it = list.Begin();
-    while (it != list.End())
+    for (size_t b = OCCUPANCY_NUM; b > 0; --b)
     {
-        // 找到管理空间非空的span
-        if (it->_freeList != nullptr)
+        SpanList& list = _partialLists[index][b - 1];
+        if (!list.Empty())
         {
-            return it;
+            return list.Begin();
         }
-        else    // 没找到继续往下找
+    }
+
+    return nullptr;
+}
+
+// span占用率变化后，将其挪到对应的子链表中
+void CentralCache::AdjustSpan(size_t index, Span* span)
+{
+    size_t bucket = OCCUPANCY_NUM;  // 没有空闲块了就挂到满链表中
+    if (span->_freeList != nullptr)
+    {
+        // 绝大多数时候占用率还在原来的区间里，先用乘法判断一下，省掉一次除法
+        size_t used = span->_usecount * OCCUPANCY_NUM;
+        if (span->_bucket != OCCUPANCY_NUM
+            && used >= span->_bucket * span->_objNum
+            && used < (span->_bucket + 1) * span->_objNum)
         {
-            it = it->_next;
+            return;
         }
+        bucket = used / span->_objNum;
     }
 
+    if (bucket != span->_bucket)
+    {
+        BucketList(index, span->_bucket).Erase(span);
+        BucketList(index, bucket).PushFront(span);
+        span->_bucket = bucket;
+    }
+}
+
+// 获取一个管理空间的非空Span
+Span* CentralCache::GetOneSpan(size_t index, size_t size)
+{
+    _objSizes[index] = size;    // 记下桶的块大小，后台线程预先切span时要用
+
+    // 先在cc中找一下有没有管理空间非空的span，有的话优先用占用率最高的
+    Span* it = FindFullestSpan(index);
+    if (it != nullptr)
+    {
+        if (it->_usecount == 0)
+        {// 用到了后台线程预先切好的span
+            _spanDemand[index].fetch_add(1, std::memory_order_relaxed);
+        }
+        return it;
+    }
+
+    SpanList& list = _spanLists[index];
+
     // 解掉桶锁，让其他向该cc桶进行操作的线程能拿到锁
     list._mtx.unlock();
 
-    // 走到这就是cc中没有找到管理空间非空的span
+    // 走到这就是cc中没有找到管理空间非空的span，向pc要一个全新的span切好
+    Span* span = CarveSpan(index, size);
 
+    // 切好span之后，需要把span挂到cc对应下标的桶里面去
+    list._mtx.lock();       // span挂上去之前加锁
+    _partialLists[index][0].PushFront(span);
+    _spanDemand[index].fetch_add(1, std::memory_order_relaxed);
+
+    return span;
+}
+
+// 向pc要一个span并切成size大小的块，调用时不能持有桶锁
+Span* CentralCache::CarveSpan(size_t index, size_t size)
+{
     // 将size转换成匹配的页数，以供pc提供一个合适的span
     size_t k = SizeClass::NumMovePage(size);
 
     // cout << "size: " << size << ", k: " << k << endl;
+    ALLOC_PROBE(cc_span_begin, index, size, k);
+
+    // 标签超出预算并且回调不允许时抛异常，回调可能做任何事，不能持有pc的锁
+    CheckTagBudget(_tag, k << PAGE_SHIFT);
 
     // 解决死锁的方法三：在调用newSpan的地方加锁
-    PageCache::GetInstance()->_pageMtx.lock();  // 加锁
+    // 超过硬上限时NewSpan会抛异常，用智能锁保证锁能被释放
+    std::unique_lock<PageMutex> lc(PageCache::GetInstance()->_pageMtx);
     // 调用NewSpan获取一个全新span
     Span* span = PageCache::GetInstance()->NewSpan(k);
     span->_isUse = true;    // cc获取到了pc中的span，改成正在使用
     span->_objSize = size;  // 记录span被切分的块大小
-    PageCache::GetInstance()->_pageMtx.unlock();    // 解锁
+    span->_tag = _tag;
+    lc.unlock();    // 解锁
+
+    ChargeTag(_tag, span->_n << PAGE_SHIFT);
 
     // 因为_pageID是PageID类型（size_t或者unsigned long long)的，不能直接赋值给指针
     char* start = (char*)(span->_pageId << PAGE_SHIFT);
-    char* end = (char*)(start + (span->_n << PAGE_SHIFT));
+
+    // 只切完整的块，span末尾不够一块的空间不能给出去，否则会越界写到相邻的页
+    span->_objNum = (span->_n << PAGE_SHIFT) / size;
+
+#if SPAN_COLORING
+    /* 着色：起始位置在末尾零头的范围内往后挪，每个新span换一种颜色
+       挪动的步长是块大小的对齐数(至少一个缓存行，最多一页)，块地址的对齐和不着色时一样 */
+    size_t step = std::max(CACHE_LINE, std::min(size & (0 - size), (size_t)1 << PAGE_SHIFT));
+    size_t colors = ((span->_n << PAGE_SHIFT) - span->_objNum * size) / step + 1;
+    size_t color = _spanColors[index].fetch_add(1, std::memory_order_relaxed);
+    if (colors == 1 && size >= CACHE_LINE && size < SPAN_COLOR_PERIOD)
+    {/* 零头不够挪一次(比如2的幂大小的块正好切满span)，第color种颜色就空出开头的color块，按块大小挪，对齐不变
+        最多空出span的1/16，64B的块只有一部分颜色，平均浪费span的1/32 */
+        colors = std::min(SPAN_COLOR_PERIOD / size, span->_objNum / 16 + 1);
+        color %= colors;
+        span->_objNum -= color;
+        start += color * size;
+    }
+    else
+    {
+        start += color % colors * step;
+    }
+#endif
+    span->_usecount = 0;
+    span->_sorted = true;   // 新切出来的块天然按地址有序
+    span->_bucket = 0;      // 全新的span占用率为0
+    span->_owner.store(nullptr, std::memory_order_relaxed);
 
     // 开始切分span管理的空间
     span->_freeList = start;    // 管理的空间放到span->_freeList中
 
     void* tail = start;     // 起初让tail指向start
-    start += size;          // start往后移一块，方便控制循环
 
     // 链接各个块
-    while (start < end)
+    for (size_t i = 1; i < span->_objNum; ++i)
     {
-        ObjNext(tail) = start;
         start += size;
-        tail = ObjNext(tail);
+        ObjNext(tail) = start;
+        tail = start;
     }
     ObjNext(tail) = nullptr;    // 将最后一块置空
 
-    // 切好span之后，需要把span挂到cc对应下标的桶里面去
-    list._mtx.lock();       // span挂上去之前加锁
-    list.PushFront(span);
-
+    ALLOC_PROBE(cc_span_end, index, size, span->_n);
     return span;
 }
 
+// 后台线程调用：让index桶中至少有num个还没用过的span
+size_t CentralCache::Prefill(size_t index, size_t num)
+{
+    size_t carved = 0;
+
+    _spanLists[index]._mtx.lock();
+    size_t size = _objSizes[index];
+    if (size == 0)
+    {// 这个桶还没人用过，不知道块大小
+        _spanLists[index]._mtx.unlock();
+        return 0;
+    }
+
+    // 还没用过的span一定在占用率最低的子链表中
+    SpanList& list = _partialLists[index][0];
+    size_t idle = 0;
+    for (Span* it = list.Begin(); it != list.End(); it = it->_next)
+    {
+        if (it->_usecount == 0)
+        {
+            ++idle;
+        }
+    }
+
+    // 切span的时候不持有桶锁，不影响其他线程从这个桶里取块
+    while (idle + carved < num)
+    {
+        _spanLists[index]._mtx.unlock();
+        Span* span = nullptr;
+        try
+        {
+            span = CarveSpan(index, size);
+        }
+        catch (const std::bad_alloc&)
+        {// 到了硬上限就不预先切了
+            return carved;
+        }
+        _spanLists[index]._mtx.lock();
+
+        // 挂到末尾，前面已经用了一部分的span先被用满
+        list.Insert(list.End(), span);
+        ++carved;
+    }
+    _spanLists[index]._mtx.unlock();
+
+    return carved;
+}
+
+// 后台线程调用：index桶中还没用过的span全部还给pc，返回还了多少个
+size_t CentralCache::ReleaseIdleSpans(size_t index)
+{
+    // 先在桶锁内把空闲span摘下来，用_next串成单链表
+    Span* idle = nullptr;
+    size_t num = 0;
+
+    _spanLists[index]._mtx.lock();
+    SpanList& list = _partialLists[index][0];
+    for (Span* it = list.Begin(); it != list.End(); )
+    {
+        Span* next = it->_next;
+        if (it->_usecount == 0)
+        {
+            list.Erase(it);
+            it->_freeList = nullptr;
+            it->_prev = nullptr;
+            it->_next = idle;
+            idle = it;
+            ++num;
+        }
+        it = next;
+    }
+    _spanLists[index]._mtx.unlock();
+
+    if (idle == nullptr)
+    {
+        return 0;
+    }
+
+    PageCache::GetInstance()->_pageMtx.lock();
+    while (idle != nullptr)
+    {
+        Span* next = idle->_next;
+        idle->_next = nullptr;
+        UnchargeTag(_tag, idle->_n << PAGE_SHIFT);
+        PageCache::GetInstance()->ReleaseSpanToPageCache(idle);
+        idle = next;
+    }
+    PageCache::GetInstance()->_pageMtx.unlock();
+
+    return num;
+}
+
+// 所有桶中还没用过的span还给pc，再让pc把空闲页的物理内存还给系统
+size_t CentralCache::Trim(size_t keepBytes)
+{
+    for (size_t i = 0; i < FREE_LIST_NUM; ++i)
+    {
+        ReleaseIdleSpans(i);
+    }
+
+    std::unique_lock<PageMutex> lc(PageCache::GetInstance()->_pageMtx);
+    return PageCache::GetInstance()->ReleaseFreePages(keepBytes);
+}
+
 // 将tc归还的多块空间放到span中
 void CentralCache::ReleaseListToSpans(void* start, size_t size)
 {
     // 先通过size找到对应的桶在哪里
     size_t index = SizeClass::Index(size);
 
+    // 带大小的释放不查span，别的标签的块可能混进了这个标签的tc，先挑出来，最后转交给那个标签的cc
+    void* other = nullptr;
+    size_t otherTag = 0;
+
     // 下面要对cc中的span进行操作，所以要加上cc的桶锁
     _spanLists[index]._mtx.lock();
 
@@ -121,7 +369,17 @@ void CentralCache::ReleaseListToSpans(void* start, size_t size)
         // 找到对应的span
         Span* span = PageCache::GetInstance()->MapObjectToSpan(start);
 
-        // 把当前块插入到对应span中
+        if (span->_tag != _tag)
+        {
+            ObjNext(start) = other;
+            other = start;
+            otherTag = span->_tag;
+            start = next;
+            continue;
+        }
+
+        // 把当前块插入到对应span中，插到空链表上或者地址比头还小时仍然有序，否则就不一定了
+        span->_sorted = span->_freeList == nullptr || (span->_sorted && start < span->_freeList);
         ObjNext(start) = span->_freeList;
         span->_freeList = start;
 
@@ -131,7 +389,7 @@ void CentralCache::ReleaseListToSpans(void* start, size_t size)
         {// 将这个span交给pc管理
 
             // 先将span从cc中删除
-            _spanLists[index].Erase(span);
+            BucketList(index, span->_bucket).Erase(span);
             span->_freeList = nullptr;
             span->_next = nullptr;
             span->_prev = nullptr;
@@ -139,6 +397,8 @@ void CentralCache::ReleaseListToSpans(void* start, size_t size)
             // 归还span，解掉当前桶锁
             _spanLists[index]._mtx.unlock();
 
+            UnchargeTag(_tag, span->_n << PAGE_SHIFT);
+
             // 归还span，加上page的整体锁
             PageCache::GetInstance()->_pageMtx.lock();
             PageCache::GetInstance()->ReleaseSpanToPageCache(span);
@@ -147,6 +407,11 @@ void CentralCache::ReleaseListToSpans(void* start, size_t size)
             // 归还完毕，再加上当前桶的桶锁
             _spanLists[index]._mtx.lock();
         }
+        else
+        {
+            // 占用率下降了，可能要换到更空的子链表中
+            AdjustSpan(index, span);
+        }
 
 
         // 换下一个块
@@ -154,4 +419,31 @@ void CentralCache::ReleaseListToSpans(void* start, size_t size)
     }
 
     _spanLists[index]._mtx.unlock();
-}
\ No newline at end of file
+
+    // 挑出来的块里如果还有第三个标签的，由otherTag的cc再挑一次，最多转交TAG_NUM次
+    if (other != nullptr)
+    {
+        GetInstance(otherTag)->ReleaseListToSpans(other, size);
+    }
+}
+
+// 统计cc中span管理的总字节数和其中空闲的字节数
+void CentralCache::GetFragmentStats(size_t& spanBytes, size_t& freeBytes)
+{
+    spanBytes = freeBytes = 0;
+
+    for (size_t i = 0; i < FREE_LIST_NUM; ++i)
+    {
+        _spanLists[i]._mtx.lock();
+        for (size_t b = 0; b <= OCCUPANCY_NUM; ++b)
+        {
+            SpanList& list = BucketList(i, b);
+            for (Span* it = list.Begin(); it != list.End(); it = it->_next)
+            {
+                spanBytes += it->_n << PAGE_SHIFT;
+                freeBytes += (it->_objNum - it->_usecount) * it->_objSize;
+            }
+        }
+        _spanLists[i]._mtx.unlock();
+    }
+}
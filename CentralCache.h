@@ -1,37 +1,90 @@
 #pragma once
 #include "Common.h"
+#include "TagStats.h"
 
 class CentralCache
 {
 public:
-    // 单例接口
-    static CentralCache* GetInstance()
+    /* 单例接口，每个标签有自己的一个cc，标签的span只挂在自己的cc中，
+       0号标签就是原来的单例，其他标签的cc第一次用到时才创建 */
+    static CentralCache* GetInstance(size_t tag = 0)
     {
-        return &_sInst;
+        return tag == 0 ? &_sInst : GetTagInstance(tag);
     }
 
     // CentralCache从自己的_spanLists中为ThreadCache提供所需要的块空间
     /*  start和end表示存储提供的空间开始和结尾，输出型参数
         n表示tc需要多少块size大小的空间
         size表示tc需要的单块空间的大小
+        owner表示取块的tc，会记录到提供块的span中，供跨线程释放时找到它
         返回值是cc实际提供的空间大小
     */
-    size_t FetchRangeObj(void*& start, void*& end, size_t batch_Num, size_t size);
+    size_t FetchRangeObj(void*& start, void*& end, size_t batch_Num, size_t size, ThreadCache* owner);
     
-    // 获取一个管理空间不为空的span
-    Span* GetOneSpan(SpanList& list, size_t size);
+    // 获取一个管理空间不为空的span，优先选择占用率最高的span
+    Span* GetOneSpan(size_t index, size_t size);
 
-    // 将tc归还回来的多块空间放到span中
+    // 将tc归还回来的多块空间放到span中，其中别的标签的块会转交给那个标签的cc
     void ReleaseListToSpans(void* start, size_t size);
 
+    // 统计cc中所有span管理的字节数，以及其中还空闲着的字节数（衡量外碎片）
+    void GetFragmentStats(size_t& spanBytes, size_t& freeBytes);
+
+    // index桶累计用掉了多少个全新的span，后台线程据此估计这个桶的需求
+    size_t SpanDemand(size_t index)
+    {
+        return _spanDemand[index].load(std::memory_order_relaxed);
+    }
+
+    // 预先切好span，让index桶中至少有num个还没用过的span，返回新切了多少个
+    size_t Prefill(size_t index, size_t num);
+
+    // 把index桶中还没用过的span全部还给pc，返回还了多少个
+    size_t ReleaseIdleSpans(size_t index);
+
+    /* 所有桶中还没用过的span还给pc，再让pc把空闲页的物理内存还给系统，pc最多留下keepBytes字节
+       返回还给系统的字节数 */
+    size_t Trim(size_t keepBytes);
+
 private:
-    // 构造函数私有化
-    CentralCache() {}
+    // 在index桶中找到占用率最高且还有空闲块的span，没有返回nullptr
+    Span* FindFullestSpan(size_t index);
+
+    // 向pc要一个span并切成size大小的块，调用时不能持有桶锁
+    Span* CarveSpan(size_t index, size_t size);
+
+    // span占用率变化后，将其挪到对应的子链表中
+    void AdjustSpan(size_t index, Span* span);
+
+    // bucket号子链表，OCCUPANCY_NUM号即是_spanLists[index]本身
+    SpanList& BucketList(size_t index, size_t bucket)
+    {
+        return bucket == OCCUPANCY_NUM ? _spanLists[index] : _partialLists[index][bucket];
+    }
+
+    // 创建tag标签的cc
+    static CentralCache* GetTagInstance(size_t tag);
+
+    // 构造函数私有化，constexpr的构造函数让_sInst在编译期就初始化好
+    constexpr explicit CentralCache(size_t tag = 0)
+        : _tag(tag)
+    {}
 
     // 删除拷贝构造函数、赋值运算符重载函数
     CentralCache(const CentralCache& copy) = delete;
     CentralCache& operator=(const CentralCache& copy) = delete;
 
-    SpanList _spanLists[FREE_LIST_NUM]; //哈希桶中挂的是一个个Span
+    /* 哈希桶中挂的是一个个Span，桶锁也在这里
+       _spanLists[i]中挂的是已经分配满的span，
+       _partialLists[i][b]中挂的是占用率在[b/OCCUPANCY_NUM, (b+1)/OCCUPANCY_NUM)之间的span
+    */
+    SpanList _spanLists[FREE_LIST_NUM];
+    SpanList _partialLists[FREE_LIST_NUM][OCCUPANCY_NUM];
+
+    size_t _objSizes[FREE_LIST_NUM] = { 0 };     // 每个桶的块大小，0表示还没用过
+    std::atomic<size_t> _spanDemand[FREE_LIST_NUM] = {};    // 每个桶累计用掉的全新span个数
+    std::atomic<size_t> _spanColors[FREE_LIST_NUM] = {};    // 每个桶切过的span个数，用来轮换span的颜色
+    size_t _tag = 0;    // 这个cc属于哪个标签，切出来的span都记在这个标签下
     static CentralCache _sInst;  // 饿汉式单例模式创建一个CentralCache
+    static std::atomic<CentralCache*> _tagInsts[TAG_NUM];   // 其他标签的cc，还没创建时为空
 };
\ No newline at end of file
@@ -5,19 +5,59 @@
 #include <cassert>
 #include <thread>
 #include <mutex>
-#include <unordered_map>
-#include "ObjectPool.h"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "Probes.h"
 
 using std::vector;
 using std::cout;
 using std::endl;
 
-static const size_t FREE_LIST_NUM = 208;    // 哈希表中自由链表个数
+#ifdef USE_SIZE_CLASS_TABLE
+    #include "SizeClassTable.h"     // 由SizeClassGen根据负载直方图生成的桶划分
+    static const size_t FREE_LIST_NUM = SIZE_CLASS_NUM;    // 哈希表中自由链表个数
+#else
+    static const size_t FREE_LIST_NUM = 208;    // 哈希表中自由链表个数
+#endif
 static const size_t MAX_BYTES = 256 * 1024; // ThreadCache单次申请的最大字节数
 static const size_t PAGE_NUM = 129;     // span的最大管理页数
 static const size_t PAGE_SHIFT = 13;    // 一页多少位，这里给一页8KB，13位
+static const size_t OCCUPANCY_NUM = 4;  // cc中每个桶按span占用率划分的子链表个数
+static const size_t LARGE_CACHE_BYTES = 64 * 1024 * 1024;  // pc最多缓存多少字节释放掉的大块span
+static const size_t LARGE_CACHE_IDLE_MS = 1000; // 缓存的大块span超过多少毫秒没被复用就还给系统
+static const size_t HOT_NUM = 8;       // 每个自由链表前面的数组最多放多少块
+static const size_t CACHE_LINE = 64;    // 缓存行的大小
 typedef size_t PageID;
 
+/* 地址空间预留模式：启动时预留一整段连续的虚拟地址空间(PROT_NONE)，用到的时候再提交物理内存
+   这样页号到span的映射可以直接用数组下标，判断指针是不是内存池的也只要比较一下范围
+   预留的大小不是堆的上限：预留失败或者预留的空间用完之后，pc退回到直接向系统要页，这些页用基数树映射
+   64位下默认打开，编译时可以用 -DRESERVE_ADDRESS_SPACE=0 关掉，所有页都用基数树映射 */
+#ifndef RESERVE_ADDRESS_SPACE
+    #if UINTPTR_MAX == 0xffffffffffffffff
+        #define RESERVE_ADDRESS_SPACE 1
+    #else
+        #define RESERVE_ADDRESS_SPACE 0
+    #endif
+#endif
+
+/* span着色：新切的span不总是从页首开始切，而是在末尾不够一块的零头范围内轮流往后挪几个缓存行，
+   不同span中同一位置的块就落在不同的缓存组里，不会互相挤占，默认打开，可以用 -DSPAN_COLORING=0 关掉 */
+#ifndef SPAN_COLORING
+    #define SPAN_COLORING 1
+#endif
+
+/* 缓存组的周期：地址相差它的整数倍的缓存行落在同一个缓存组里
+   2的幂大小的块正好切满span，没有零头，小于它的这些桶要空出开头的几块来着色 */
+static const size_t SPAN_COLOR_PERIOD = 4096;
+
+// 最多预留多少字节的虚拟地址空间，预留不到就减半再试，最少1GB(RESERVE_BYTES本身更小时就是RESERVE_BYTES)
+#ifndef RESERVE_BYTES
+    #define RESERVE_BYTES ((size_t)64 << 30)
+#endif
+
 
 
 // #ifdef _WIN32
@@ -55,10 +95,26 @@ inline static void* SystemAlloc(size_t kpage)
 #ifdef _WIN32   // Windows下的系统调用接口
     ptr = VirtualAlloc(0, kpage << PAGE_SHIFT, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
 #else           // Linux/MacOS系统调用
-    ptr = mmap(nullptr, kpage << PAGE_SHIFT, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (ptr == MAP_FAILED)      // mmap失败
+    /* mmap只保证按系统页(4KB)对齐，而这里的一页是8KB，span通过地址右移PAGE_SHIFT得到页号，
+       所以多申请一页，再把首尾多出来的部分还回去，保证返回的地址按8KB对齐 */
+    size_t size = kpage << PAGE_SHIFT;
+    size_t align = (size_t)1 << PAGE_SHIFT;
+    void* raw = mmap(nullptr, size + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw != MAP_FAILED)      // mmap成功
     {
-        ptr = nullptr;
+        char* start = (char*)raw;
+        char* aligned = (char*)(((size_t)start + align - 1) & ~(align - 1));
+        char* end = start + size + align;
+
+        if (aligned > start)
+        {
+            munmap(start, aligned - start);
+        }
+        if (end > aligned + size)
+        {
+            munmap(aligned + size, end - (aligned + size));
+        }
+        ptr = aligned;
     }
 #endif
     
@@ -83,6 +139,63 @@ inline static void SystemFree(void* ptr, size_t size)
 #endif
 }
 
+// 预留size字节按页对齐的虚拟地址空间，不能访问也不占物理内存，失败返回nullptr
+inline static void* SystemReserve(size_t size)
+{
+#ifdef _WIN32
+    return VirtualAlloc(0, size, MEM_RESERVE, PAGE_NOACCESS);     // Windows保证按64KB对齐
+#else
+    size_t align = (size_t)1 << PAGE_SHIFT;
+    void* raw = mmap(nullptr, size + align, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    // 和SystemAlloc一样，按8KB对齐，多出来的部分还回去
+    char* start = (char*)raw;
+    char* aligned = (char*)(((size_t)start + align - 1) & ~(align - 1));
+    if (aligned > start)
+    {
+        munmap(start, aligned - start);
+    }
+    munmap(aligned + size, start + align - aligned);
+    return aligned;
+#endif
+}
+
+// 提交预留地址空间中的[ptr, ptr + size)，之后才可以读写
+inline static void SystemCommit(void* ptr, size_t size)
+{
+#ifdef _WIN32
+    if (VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+#else
+    if (mprotect(ptr, size, PROT_READ | PROT_WRITE) != 0)
+    {
+        throw std::bad_alloc();
+    }
+#endif
+}
+
+/* 把[ptr, ptr + size)的物理内存还给系统，地址仍然保留并且可以继续读写
+   返回之后再读这段空间是不是一定全是0 */
+inline static bool SystemDecommit(void* ptr, size_t size)
+{
+#ifdef _WIN32
+    VirtualAlloc(ptr, size, MEM_RESET, PAGE_READWRITE);
+    return false;   // MEM_RESET之后内容是不确定的
+#else
+    // 私有匿名映射MADV_DONTNEED之后，下次访问会重新映射全0的页
+    return madvise(ptr, size, MADV_DONTNEED) == 0;
+#endif
+}
+
+// 定长内存池向系统按页申请空间，要放在SystemAlloc后面
+#include "ObjectPool.h"
+
 /* ObjNext如果没有引用，返回的是一个右值，因为ObjNext返回值是一个拷贝，是一个临时对象，
 临时对象具有常属性，不能被修改，即是一个右值，右值无法进行赋值操作 */
 static void*& ObjNext(void* obj)    // obj的头4/8个字节
@@ -90,7 +203,96 @@ static void*& ObjNext(void* obj)    // obj的头4/8个字节
     return *(void**)obj;
 }
 
-// ThreadCache中的自由链表
+// 提前把ptr所在的缓存行读进来，不支持的编译器什么都不做
+static inline void Prefetch(void* ptr)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(ptr, 1, 3);  // 块拿出去马上就会被写
+#else
+    (void)ptr;
+#endif
+}
+
+// 将两条按地址升序的块链表合并成一条
+static inline void* MergeObjList(void* left, void* right)
+{
+    void* head = nullptr;
+    void** tail = &head;    // tail指向新链表最后一个节点的next
+
+    while (left && right)
+    {
+        if (left < right)
+        {
+            *tail = left;
+            left = ObjNext(left);
+        }
+        else
+        {
+            *tail = right;
+            right = ObjNext(right);
+        }
+        tail = &ObjNext(*tail);
+    }
+    *tail = left ? left : right;
+
+    return head;
+}
+
+/* 将块链表按地址升序排序（自底向上归并），不需要额外申请空间
+   bins[i]中存放的是长度为2^i的有序链表 */
+static inline void* SortObjList(void* head)
+{
+    void* bins[64] = { nullptr };
+    size_t binNum = 0;
+
+    while (head)
+    {
+        // 摘下一个块，作为长度为1的有序链表
+        void* carry = head;
+        head = ObjNext(head);
+        ObjNext(carry) = nullptr;
+
+        // 像二进制加法一样向上进位合并
+        size_t i = 0;
+        while (bins[i] != nullptr)
+        {
+            carry = MergeObjList(bins[i], carry);
+            bins[i] = nullptr;
+            ++i;
+        }
+        bins[i] = carry;
+
+        if (i + 1 > binNum)
+        {
+            binNum = i + 1;
+        }
+    }
+
+    void* res = nullptr;
+    for (size_t i = 0; i < binNum; ++i)
+    {
+        res = MergeObjList(bins[i], res);
+    }
+
+    return res;
+}
+
+/* 自由链表和cc之间批量移动块的状态，由BatchPolicy.h中的策略维护
+   _highWater：链表中的块数到了这么多就要还一部分给cc
+   _lowWater：还给cc之后链表中留下多少块 */
+struct BatchState
+{
+    size_t _maxSize = 1;    // 下一次从cc取多少块(不超过桶的上限)，初始值为1，表示第一次能申请的就是1块
+    size_t _highWater = 1;
+    size_t _lowWater = 0;
+    size_t _misses = 0;     // 连续几次链表空了去cc取，中间没有还过
+    size_t _overflows = 0;  // 连续几次到了高水位还给cc，中间没有取过
+};
+
+/* ThreadCache中的自由链表
+   最近还回来的HOT_NUM块放在_hot数组中，按栈的方式存取，不需要沿着链表去读块的头8字节，
+   数组满了才挂到_freeList链表上
+*/
 class FreeList
 {
 public:
@@ -100,6 +302,14 @@ public:
         // 删除块数不能超过size块
         assert(n <= _size);
 
+        // 先把数组中的块都挂回链表，统一从链表中取
+        while (_hotSize > 0)
+        {
+            void* obj = _hot[--_hotSize];
+            ObjNext(obj) = _freeList;
+            _freeList = obj;
+        }
+
         start = end = _freeList;
 
         for (size_t i = 0; i < n - 1; ++i)
@@ -129,50 +339,116 @@ public:
 
     bool Empty()    // 判断哈希表是否为空
     {
-        return _freeList == nullptr;
+        return _size == 0;
     }
     
     void Push(void* obj)    // 回收空间
     {
-        // 头插法
         assert(obj);    // 插入非法空间
 
-        // *(void**)obj = _freeList;
-        ObjNext(obj) = _freeList;
-        _freeList = obj;
+        if (_hotSize < HOT_NUM)
+        {// 数组没满先放数组
+            _hot[_hotSize++] = obj;
+        }
+        else
+        {// 头插法
+            // *(void**)obj = _freeList;
+            ObjNext(obj) = _freeList;
+            _freeList = obj;
+        }
 
         ++_size;    // 插入一块，size + 1
     }
 
     void* Pop()     // 提供空间
-    {   // 头删法
-        assert(_freeList);  // 提供空间的前提是要有空间
+    {
+        assert(_size > 0);  // 提供空间的前提是要有空间
+
+        --_size;    // 去掉一块，_size - 1
+
+        if (_hotSize > 0)
+        {
+            return _hot[--_hotSize];
+        }
 
+        // 头删法
         void* obj = _freeList;
         _freeList = ObjNext(obj);
 
-        --_size;    // 去掉一块，_size - 1
+        // 下一次Pop要读新头块的头8字节，提前预取，避免下次申请时再等一次缓存缺失
+        if (_freeList != nullptr)
+        {
+            Prefetch(_freeList);
+        }
 
         return obj;
     }
 
-    // FreeList当前未到上限时，能够申请的最大块空间是多少
-    size_t& MaxSize()
+    // 直接丢掉链表中所有的块（块所在的span会被整体回收时使用）
+    void Clear()
     {
-        return _maxSize;
+        _freeList = nullptr;
+        _hotSize = 0;
+        _size = 0;
+    }
+
+    // 块数到了高水位就要还一部分给cc
+    size_t HighWater()
+    {
+        return _batch._highWater;
+    }
+
+    BatchState& Batch()
+    {
+        return _batch;
     }
 
 private:
     void* _freeList = nullptr;  // 自由链表，初始为空
-    /* 当前自由链表申请未达到上限时，能够申请的最大块空间_maxSize
-       初始值为1，表示第一次能申请的就是1块
-       到了上限之后_maxSize这个值就作废了    
-    */
-    size_t _maxSize = 1;
+    BatchState _batch;  // 和cc之间批量移动块的状态
+
+    size_t _size = 0;   // 当前自由链表中有多少块空间，包括_hot数组中的
 
-    size_t _size = 0;   // 当前自由链表中有多少块空间
+    void* _hot[HOT_NUM];    // 最近还回来的块
+    size_t _hotSize = 0;    // _hot数组中有多少块
 };
 
+#ifdef USE_SIZE_CLASS_TABLE
+/* size到桶下标的查找表，编译期生成
+   1024B以内按8B一格，之后按128B一格，SizeClassGen生成的桶大小都落在这些格点上
+*/
+struct SizeClassLookup
+{
+    static const size_t SMALL_SLOT = 1024 >> 3;
+    static const size_t SLOT_NUM = SMALL_SLOT + ((MAX_BYTES - 1024) >> 7) + 1;
+
+    static constexpr size_t Slot(size_t size)
+    {
+        return size <= 1024 ? (size + 7) >> 3 : SMALL_SLOT + ((size - 1024 + 127) >> 7);
+    }
+
+    constexpr SizeClassLookup()
+        : _index()
+    {
+        size_t cls = 0;
+        for (size_t i = 1; i < SLOT_NUM; ++i)
+        {
+            size_t size = i <= SMALL_SLOT ? i << 3 : 1024 + ((i - SMALL_SLOT) << 7);
+            while (SIZE_CLASS_BYTES[cls] < size)
+            {
+                ++cls;
+            }
+            _index[i] = (unsigned short)cls;
+        }
+    }
+
+    unsigned short _index[SLOT_NUM];
+};
+
+static constexpr SizeClassLookup SIZE_CLASS_LOOKUP;
+static_assert(SIZE_CLASS_BYTES[SIZE_CLASS_NUM - 1] == MAX_BYTES, "last size class must be MAX_BYTES");
+#endif
+
 class SizeClass
 {
     // 线程申请size的对齐规则：整体控制在最多10%左右的内碎片浪费
@@ -198,13 +474,21 @@ public:
     //     return res;
     // }
     // 二进制写法
-    static size_t _RoundUp(size_t size, size_t alignNum)
+    // 这几个函数都是constexpr的，大小是编译期常量时整个计算在编译期完成
+    static constexpr size_t _RoundUp(size_t size, size_t alignNum)
     {
         return ((size + alignNum - 1) & ~(alignNum - 1));
     }
 
-    static size_t RoundUp(size_t size)  // 计算对齐后的字节数
+    static constexpr size_t RoundUp(size_t size)  // 计算对齐后的字节数
     {
+#ifdef USE_SIZE_CLASS_TABLE
+        if (size <= MAX_BYTES)
+        {   // 生成的桶划分下，对齐后的字节数就是所在桶的块大小
+            return SIZE_CLASS_BYTES[Index(size)];
+        }
+        return _RoundUp(size, 1 << PAGE_SHIFT);
+#else
         if (size <= 128)   
         {   // [1, 128] 8B
             return _RoundUp(size, 8);
@@ -229,23 +513,27 @@ public:
         {   // 单次申请空间大于256KB，直接按照页来对齐
             return _RoundUp(size, 1 << PAGE_SHIFT);
         }
+#endif
     }
 
     // 求size对应在哈希表中的下标
     // align_shift指对齐数的二进制位数，如size=2，对齐数为8=2^3，align_shift=3
-    static inline size_t _Index(size_t size, size_t align_shift)
+    static constexpr size_t _Index(size_t size, size_t align_shift)
     {
         return ((size + (1 << align_shift) - 1) >> align_shift) - 1;
     }
 
     // 计算映射的是哪一个自由链表桶
     // _Index计算的是当前size所在区域的第几个下标，所以Index返回值需要加上前面所有哈希桶个数
-    static inline size_t Index(size_t size)
+    static constexpr size_t Index(size_t size)
     {
         assert(size <= MAX_BYTES);
-        
+
+#ifdef USE_SIZE_CLASS_TABLE
+        return SIZE_CLASS_LOOKUP._index[SizeClassLookup::Slot(size)];
+#else
         // 每个区间有多少个链表
-        static int group_array[4] = {16, 56, 56, 56};
+        constexpr int group_array[4] = {16, 56, 56, 56};
         if (size <= 128)
         {   // [1, 128] 8B   --> 8=2^3
             return _Index(size, 3);
@@ -272,12 +560,16 @@ public:
             assert(false);
         }
         return -1;
+#endif
     }
 
-    static size_t NumMoveSize(size_t size)
+    static constexpr size_t NumMoveSize(size_t size)
     {
         assert(size > 0);   // 不能申请0大小的空间
 
+#ifdef USE_SIZE_CLASS_TABLE
+        return SIZE_CLASS_MOVE_NUM[Index(size)];
+#else
         // MAX_BYTES即单个块的最大空间，也就是256KB
         int num = MAX_BYTES / size; 
 
@@ -302,6 +594,7 @@ public:
         // 小对象一次批量上限低
 
         return num;
+#endif
     }
 
     // 块页匹配算法（size表示一块的大小
@@ -310,6 +603,9 @@ public:
         此时需要根据一块空间大小来匹配出一个维护页空间较为合适的span，
         以保证span为size后尽量不浪费或不足够还再频繁申请相同大小的span
         */
+#ifdef USE_SIZE_CLASS_TABLE
+        return SIZE_CLASS_MOVE_PAGE[Index(size)];
+#else
 
         // NumMoveSize是算出tc向cc申请size大小的块时的单次最大申请块数
         size_t num = NumMoveSize(size);
@@ -331,9 +627,12 @@ public:
     //    }
 
         return npage == 0 ? 1 : npage;
+#endif
     }
 };
 
+class ThreadCache;
+
 // 以页为基本单位的结构体
 struct Span
 {
@@ -344,10 +643,24 @@ struct Span
     Span* _next = nullptr;  // 指向前一个节点
     Span* _prev = nullptr;  // 指向后一个节点
 
+    Span* _left = nullptr;  // pc中超过128页的空闲span组成的SpanTree中的左右孩子
+    Span* _right = nullptr;
+
     void* _freeList = nullptr;  // 每个span下面挂的小块空间的头结点
     size_t _usecount = 0;   // 当前span分配出去了多少个块空间
+    size_t _objNum = 0;     // 当前span总共切分出了多少个块空间
+    size_t _bucket = 0;     // span在cc中按占用率所在的子链表，OCCUPANCY_NUM表示已经分配满了
+    bool _sorted = true;    // _freeList是否是按地址升序的
 
     bool _isUse = false;    // 判断当前span是在cc中还是在pc中
+    bool _zeroed = false;   // span管理的页是否确定全是0（刚从系统申请的或者物理内存刚被还给系统）
+    size_t _freeTime = 0;   // 大块span放进pc缓存的时间(ms)
+    size_t _tag = 0;        // span属于哪个标签，只有cc切的span和大块空间的span才有意义
+
+    /* 最近一次从这个span批量取块的tc，其他线程释放这个span中的块时，
+       直接无锁地挂到这个tc的远程释放链表中，让块尽量回到申请它的线程
+       它不一定是申请这一块的线程，只是一个提示：挂不上去(线程退出了、链表攒满了)就清空，块走普通的释放路径 */
+    std::atomic<ThreadCache*> _owner{ nullptr };
 };
 
 class SpanList
@@ -357,7 +670,7 @@ public:
     Span* PopFront()
     {
         // 先获取到_head后面的第一个span
-        Span* front = _head->_next;
+        Span* front = _head._next;
         // 删除掉这个span，直接复用Erase
         Erase(front);
 
@@ -368,7 +681,7 @@ public:
     // 判空
     bool Empty()
     {// 双向循环空的时候_head指向自己
-        return _head == _head->_next;
+        return &_head == _head._next;
     }
 
     // 头插法
@@ -380,24 +693,27 @@ public:
     // 头结点
     Span* Begin()
     {
-        return _head->_next;
+        return _head._next;
     }
 
     // 尾节点
     Span* End()
     {
-        return _head;
+        return &_head;
     }
 
-    SpanList()
-    {// 构造函数中哨兵头结点
-        _head = new Span;
-
-        // 双向链表
-        _head->_next = _head;
-        _head->_prev = _head;
+    /* 哨兵头结点直接放在SpanList里面，不用new，
+       构造函数是constexpr的，全局的cc/pc在编译期就能初始化好，不需要在main之前申请内存 */
+    constexpr SpanList()
+    {// 双向链表
+        _head._next = &_head;
+        _head._prev = &_head;
     }
 
+    // 哨兵位是独占的，不能拷贝
+    SpanList(const SpanList& copy) = delete;
+    SpanList& operator=(const SpanList& copy) = delete;
+
     void Insert(Span* pos, Span* ptr)
     {// 在pos前面插入ptr
         assert(pos);
@@ -415,7 +731,7 @@ public:
     void Erase(Span* pos)
     {
         assert(pos);
-        assert(pos != _head);   // pos不能是哨兵位
+        assert(pos != &_head);  // pos不能是哨兵位
 
         Span* prev = pos->_prev;
         Span* next = pos->_next;
@@ -428,10 +744,172 @@ public:
     }
 
 public:
-    std::mutex _mtx;    // 每个CentralCache中的哈希桶都要有一个桶锁
+    BucketMutex _mtx;    // 每个CentralCache中的哈希桶都要有一个桶锁
     
 private:
-    Span* _head;    // 哨兵位头结点
+    Span _head;     // 哨兵位头结点
+};
+
+/* 按(页数, 页号)从小到大排序的span集合，pc中超过128页的空闲span放在这里
+   用span中的_left/_right组成一棵treap，节点的优先级是页号的哈希值，期望深度是O(log n)，
+   插入、删除、找页数不小于k的最小span都是O(log n)的，也不用为了有序容器再去申请内存 */
+class SpanTree
+{
+public:
+    bool Empty() const
+    {
+        return _root == nullptr;
+    }
+
+    void Insert(Span* span)
+    {
+        span->_left = span->_right = nullptr;
+        _root = Insert(_root, span);
+    }
+
+    void Erase(Span* span)
+    {
+        _root = Erase(_root, span);
+        span->_left = span->_right = nullptr;
+    }
+
+    // 页数不小于n的最小的span，页数相同时取地址最低的，没有返回nullptr
+    Span* LowerBound(size_t n)
+    {
+        Span* best = nullptr;
+        for (Span* it = _root; it != nullptr; )
+        {
+            if (it->_n >= n)
+            {
+                best = it;
+                it = it->_left;
+            }
+            else
+            {
+                it = it->_right;
+            }
+        }
+        return best;
+    }
+
+    // 页数最大的span，空的时候返回nullptr
+    Span* Max()
+    {
+        Span* it = _root;
+        while (it != nullptr && it->_right != nullptr)
+        {
+            it = it->_right;
+        }
+        return it;
+    }
+
+    // 从大到小遍历，func返回false时停下来，遍历的过程中不能插入删除
+    template<class Func>
+    void ForEachDescending(Func func)
+    {
+        ForEachDescending(_root, func);
+    }
+
+    constexpr SpanTree() {}
+
+    SpanTree(const SpanTree& copy) = delete;
+    SpanTree& operator=(const SpanTree& copy) = delete;
+
+private:
+    Span* _root = nullptr;
+
+    static bool Less(const Span* a, const Span* b)
+    {
+        return a->_n < b->_n || (a->_n == b->_n && a->_pageId < b->_pageId);
+    }
+
+    // 乘一个奇数是页号到优先级的一一映射，不同的span优先级不会相同
+    static size_t Priority(const Span* span)
+    {
+        return (size_t)span->_pageId * (size_t)0x9E3779B97F4A7C15ull;
+    }
+
+    // 把t分成小于key的l和不小于key的r
+    static void Split(Span* t, const Span* key, Span*& l, Span*& r)
+    {
+        if (t == nullptr)
+        {
+            l = r = nullptr;
+        }
+        else if (Less(t, key))
+        {
+            Split(t->_right, key, t->_right, r);
+            l = t;
+        }
+        else
+        {
+            Split(t->_left, key, l, t->_left);
+            r = t;
+        }
+    }
+
+    // l中的span都比r中的小
+    static Span* Merge(Span* l, Span* r)
+    {
+        if (l == nullptr || r == nullptr)
+        {
+            return l != nullptr ? l : r;
+        }
+        if (Priority(l) > Priority(r))
+        {
+            l->_right = Merge(l->_right, r);
+            return l;
+        }
+        r->_left = Merge(l, r->_left);
+        return r;
+    }
+
+    static Span* Insert(Span* t, Span* span)
+    {
+        if (t == nullptr)
+        {
+            return span;
+        }
+        if (Priority(span) > Priority(t))
+        {// span的优先级更高，当这棵子树的根
+            Split(t, span, span->_left, span->_right);
+            return span;
+        }
+        if (Less(span, t))
+        {
+            t->_left = Insert(t->_left, span);
+        }
+        else
+        {
+            t->_right = Insert(t->_right, span);
+        }
+        return t;
+    }
+
+    static Span* Erase(Span* t, Span* span)
+    {
+        assert(t != nullptr);   // span一定在树中
+        if (t == span)
+        {
+            return Merge(t->_left, t->_right);
+        }
+        if (Less(span, t))
+        {
+            t->_left = Erase(t->_left, span);
+        }
+        else
+        {
+            t->_right = Erase(t->_right, span);
+        }
+        return t;
+    }
+
+    template<class Func>
+    static bool ForEachDescending(Span* t, Func& func)
+    {
+        return t == nullptr
+            || (ForEachDescending(t->_right, func) && func(t) && ForEachDescending(t->_left, func));
+    }
 };
 
 
@@ -1,6 +1,147 @@
 #pragma once
 // #include "ThreadCache.h"
 #include "ThreadCache.cpp"
+#include "Heap.cpp"
+#include "Maintenance.cpp"
+#include "SharedHeap.cpp"
+
+// 获取当前线程tag标签的tc，第一次调用时创建
+static ThreadCache* GetTagCache(size_t tag)
+{
+    assert(tag < TAG_NUM);
+
+    /* 因为pTLSTagCaches是TLS的，每个线程都会有一个，且相互独立，所以不存在竞争pTLSTagCaches的问题，
+    所以这里只需要判断一次就可以直接new，不存在线程安全问题 */
+    if (pTLSTagCaches[tag] == nullptr)
+    {
+        // pTLSTagCaches[tag] = new ThreadCache(tag);     // 不用new（malloc）
+        // 此时就相当于每个线程都有了一个ThreadCache对象
+
+        // 用定长内存池来申请空间
+        static ObjectPool<ThreadCache> objPool; // 静态的，一直存在
+        objPool._poolMtx.lock();    // 加锁，不然多线程可能会申请到空指针
+        pTLSTagCaches[tag] = objPool.New(tag);
+        objPool._poolMtx.unlock();  // 解锁
+
+        tlsThreadCacheHolder._active = true;    // 线程退出时关掉这个线程的tc
+    }
+
+    return pTLSTagCaches[tag];
+}
+
+// 获取当前线程正在用的tc，第一次调用时创建默认的tc
+static inline ThreadCache* GetThreadCache()
+{
+    if (pTLSThreadCache == nullptr)
+    {
+        pTLSThreadCache = GetTagCache(0);
+    }
+
+    return pTLSThreadCache;
+}
+
+/* 超过硬上限申请失败时调用的回调，size是这次申请的字节数
+   回调可以释放一些内存之后返回true让内存池再试一次，返回false申请就抛出std::bad_alloc */
+typedef bool (*ConcurrentOomHandler)(size_t size);
+static std::atomic<ConcurrentOomHandler> s_oomHandler{ nullptr };
+
+// 当前线程每个标签的tc中缓存的块都还给cc
+static void ReleaseThreadCaches()
+{
+    for (size_t tag = 0; tag < TAG_NUM; ++tag)
+    {
+        if (pTLSTagCaches[tag] != nullptr)
+        {
+            pTLSTagCaches[tag]->ReleaseAll();
+        }
+    }
+}
+
+// 把当前线程tc中缓存的块、cc中没用过的span还回去，pc中空闲页的物理内存还给系统
+static void ReclaimMemory()
+{
+    ReleaseThreadCaches();
+    CentralCache::GetInstance()->Trim(0);
+}
+
+/* 调用alloc申请，超过硬上限失败时先把能回收的都回收了再试一次，
+   还是不行就交给OOM回调，没有回调或者回调放弃了就把std::bad_alloc抛给调用者 */
+template<class AllocFunc>
+static auto AllocOrReclaim(size_t size, AllocFunc alloc) -> decltype(alloc())
+{
+    bool reclaimed = false;
+    while (true)
+    {
+        try
+        {
+            return alloc();
+        }
+        catch (const TagBudgetExceeded&)
+        {// 超出标签的预算，tc中缓存的块还回去之后标签的span可能变少，再试一次，不交给OOM回调
+            if (reclaimed)
+            {
+                throw;
+            }
+            ReclaimMemory();
+            reclaimed = true;
+        }
+        catch (const std::bad_alloc&)
+        {
+            if (!reclaimed)
+            {
+                ReclaimMemory();
+                reclaimed = true;
+                continue;
+            }
+
+            ConcurrentOomHandler handler = s_oomHandler.load(std::memory_order_acquire);
+            if (handler == nullptr || !handler(size))
+            {
+                throw;
+            }
+        }
+    }
+}
+
+// 超过256KB的空间直接向pc申请，返回提供空间的span
+static Span* ConcurrentAllocLarge(size_t size)
+{
+    size_t alignSize = SizeClass::RoundUp(size);    // 按页大小对齐
+    size_t k = alignSize >> PAGE_SHIFT;     // 对齐之后需要多少页
+    size_t tag = pTLSThreadCache != nullptr ? pTLSThreadCache->Tag() : 0;   // 记在当前的标签下
+    ALLOC_PROBE(large_alloc_begin, size);
+
+    Span* span = AllocOrReclaim(size, [k, tag]() {
+        CheckTagBudget(tag, k << PAGE_SHIFT);
+
+        // 对pc中的span进行操作，加锁，超过硬上限时NewSpan会抛异常，用智能锁
+        std::unique_lock<PageMutex> lc(PageCache::GetInstance()->_pageMtx);
+        Span* span = PageCache::GetInstance()->NewSpan(k);  // 直接向pc申请k页
+        span->_isUse = true;    // 正在使用，不能被pc合并
+        // 记录的是span实际的字节数，从缓存中复用的span可能比k页还大
+        span->_objSize = span->_n << PAGE_SHIFT;
+        span->_tag = tag;
+        return span;
+    });
+    ChargeTag(tag, span->_objSize);
+    ALLOC_PROBE(large_alloc_end, size, (void*)(span->_pageId << PAGE_SHIFT), span->_n);
+
+    // 超过了软上限，小块空间在tc的慢路径上回收，大块空间在这里回收
+    if (PageCache::GetInstance()->TakeSoftLimitHit())
+    {
+        ReclaimMemory();
+    }
+
+    return span;
+}
+
+// 不超过256KB的空间从当前线程的tc申请
+static inline void* ConcurrentAllocSmall(size_t size)
+{
+    return AllocOrReclaim(size, [size]() {
+        return GetThreadCache()->Allocate(size);
+    });
+}
 
 // 相当于TCMalloc，线程调用这个函数申请空间
 void* ConcurrentAlloc(size_t size)
@@ -8,38 +149,74 @@ void* ConcurrentAlloc(size_t size)
     // 如果申请空间超过256KB，直接找下层的去要
     if (size > MAX_BYTES)
     {
-        size_t alignSize = SizeClass::RoundUp(size);    // 按页大小对齐
-        size_t k = alignSize >> PAGE_SHIFT;     // 对齐之后需要多少页
-
-        PageCache::GetInstance()->_pageMtx.lock();  // 对pc中的span进行操作，加锁
-        Span* span = PageCache::GetInstance()->NewSpan(k);  // 直接向pc申请k页
-        span->_objSize = size;      
-        PageCache::GetInstance()->_pageMtx.unlock();    // 解锁
-
+        Span* span = ConcurrentAllocLarge(size);
         void* ptr = (void*)(span->_pageId << PAGE_SHIFT);   // 通过获得的span提供空间
         return ptr;
     }
     else
     {
-        /* 因为pTLSThreadCache是TLS的，每个线程都会有一个，且相互独立，所以不存在竞争pTLSThreadCache的问题，
-        所以这里只需要判断一次就可以直接new，不存在线程安全问题 */
-        if (pTLSThreadCache == nullptr)
+        // cout << std::this_thread::get_id() << " " << pTLSThreadCache << endl; 
+
+        return ConcurrentAllocSmall(size);
+    }
+    
+}
+
+// 申请n个size大小的对象并清零，n * size溢出时返回nullptr
+void* ConcurrentCalloc(size_t n, size_t size)
+{
+    if (size != 0 && n > (size_t)-1 / size)
+    {
+        return nullptr;
+    }
+
+    size_t bytes = n * size;
+    if (bytes == 0)
+    {
+        bytes = 1;  // 内存池不支持申请0字节
+    }
+
+    if (bytes > MAX_BYTES)
+    {
+        // 大块空间如果是刚从系统拿的页，本来就是0，不用再把每一页都写一遍
+        Span* span = ConcurrentAllocLarge(bytes);
+        void* ptr = (void*)(span->_pageId << PAGE_SHIFT);
+        if (!span->_zeroed)
         {
-            // pTLSThreadCache = new ThreadCache;     // 不用new（malloc）
-            // 此时就相当于每个线程都有了一个ThreadCache对象
-
-            // 用定长内存池来申请空间
-            static ObjectPool<ThreadCache> objPool; // 静态的，一直存在
-            objPool._poolMtx.lock();    // 加锁，不然多线程可能会申请到空指针
-            pTLSThreadCache = objPool.New();    
-            objPool._poolMtx.unlock();  // 解锁
+            memset(ptr, 0, bytes);
         }
+        return ptr;
+    }
 
-        // cout << std::this_thread::get_id() << " " << pTLSThreadCache << endl; 
+    // 小块空间是从切好的span里拿的，块里面有链表指针，一定要清零
+    void* ptr = ConcurrentAllocSmall(bytes);
+    memset(ptr, 0, bytes);
+    return ptr;
+}
 
-        return pTLSThreadCache->Allocate(size);
+/* 申请至少size大小的空间，usable返回实际可以使用的字节数
+   小块空间是所在桶的块大小，大块空间是span的字节数，
+   vector/string这类容器可以直接把多出来的部分当作容量，不用提前扩容 */
+void* ConcurrentAllocAtLeast(size_t size, size_t& usable)
+{
+    if (size > MAX_BYTES)
+    {
+        Span* span = ConcurrentAllocLarge(size);
+        usable = span->_objSize;
+        return (void*)(span->_pageId << PAGE_SHIFT);
     }
-    
+
+    usable = SizeClass::RoundUp(size);
+    return ConcurrentAllocSmall(size);
+}
+
+// ptr实际可以使用的字节数，ptr必须是ConcurrentAlloc系列函数返回的
+size_t ConcurrentUsableSize(void* ptr)
+{
+    assert(ptr);
+
+    // 预留地址空间时查页号映射不用加锁
+    return PageCache::GetInstance()->MapObjectToSpan(ptr)->_objSize;
 }
 
 // 线程调用这个函数用来回收空间
@@ -54,6 +231,8 @@ void ConcurrentFree(void* ptr)
     // 通过size判断是不是大于256KB
     if (size > MAX_BYTES)
     {
+        ALLOC_PROBE(large_free, ptr, size);
+        UnchargeTag(span->_tag, size);
 
         PageCache::GetInstance()->_pageMtx.lock();
         PageCache::GetInstance()->ReleaseSpanToPageCache(span);
@@ -61,7 +240,564 @@ void ConcurrentFree(void* ptr)
     }
     else
     {
-        pTLSThreadCache->Deallocate(ptr, size);
+        /* 块所在的span最近是别的线程在取，就无锁地还给那个线程，不进本线程的tc，
+           这样生产者/消费者模式下块不用经过cc的桶锁就能回到生产者手里
+           否则还给本线程里和块同一个标签的tc */
+        ThreadCache* owner = span->_owner.load(std::memory_order_relaxed);
+        if (owner != nullptr && owner != pTLSTagCaches[span->_tag])
+        {
+            if (owner->RemoteFree(ptr, size))
+            {
+                return;
+            }
+
+            // 那个线程退出了或者一直没来取，清掉归属，之后这个span的块都走普通的路径，直到有线程再来取块
+            span->_owner.compare_exchange_strong(owner, nullptr, std::memory_order_relaxed);
+        }
+
+        GetTagCache(span->_tag)->Deallocate(ptr, size);
+    }
+
+}
+
+/* 带大小的释放，size必须是申请时传入的大小，或者ConcurrentAllocAtLeast返回的usable
+   小块空间不需要通过页号去查span，直接还给当前线程的tc
+   带标签的块这样释放可能进了别的标签的tc，被别的标签复用，cc收回时会还到原来的标签，统计不会错 */
+void ConcurrentFree(void* ptr, size_t size)
+{
+    assert(ptr);
+
+    if (size > MAX_BYTES)
+    {
+        ConcurrentFree(ptr);    // 大块空间要通过span才能还给pc
+    }
+    else
+    {
+        GetThreadCache()->Deallocate(ptr, size);
+    }
+}
+
+/* 大小是编译期常量的申请，ConcurrentAlloc<sizeof(T)>()
+   桶下标和走大块还是小块都在编译期确定，内联之后快路径只有读TLS和取自由链表头，
+   tc还没创建或者链表空了才走通用的慢路径 */
+template<size_t N>
+inline void* ConcurrentAlloc()
+{
+    static_assert(N > 0, "不能申请0大小的空间");
+
+    if constexpr (N > MAX_BYTES)
+    {
+        return ConcurrentAlloc(N);
+    }
+    else
+    {
+        constexpr size_t index = SizeClass::Index(N);
+        ThreadCache* tc = pTLSThreadCache;
+        void* ptr = tc != nullptr ? tc->TryAllocate(index) : nullptr;
+        return ptr != nullptr ? ptr : ConcurrentAllocSmall(N);
+    }
+}
+
+// 和ConcurrentAlloc<N>配对的释放，也可以释放ConcurrentAlloc(N)申请的空间，相当于ConcurrentFree(ptr, N)
+template<size_t N>
+inline void ConcurrentFree(void* ptr)
+{
+    static_assert(N > 0, "不能释放0大小的空间");
+    assert(ptr);
+
+    if constexpr (N > MAX_BYTES)
+    {
+        ConcurrentFree(ptr);    // 大块空间要通过span才能还给pc
+    }
+    else
+    {
+        constexpr size_t index = SizeClass::Index(N);
+        ThreadCache* tc = pTLSThreadCache;
+        if (tc != nullptr)
+        {
+            tc->Deallocate(ptr, index, N);
+        }
+        else
+        {// 还没有tc，走通用路径创建
+            ConcurrentFree(ptr, N);
+        }
+    }
+}
+
+/* 标签作用域：对象存在期间，当前线程的申请都记在tag标签下，包括ConcurrentAlloc<N>和容器的申请
+   做法是把当前线程正在用的tc换成这个标签的tc，快路径和没有标签时完全一样，析构时换回来，可以嵌套
+   ConcurrentFree(ptr)会查span，块还给和它同一个标签的tc，不受作用域影响
+   带大小的释放(ConcurrentFree(ptr, size)、ConcurrentFree<N>、ConcurrentDelete)不查span，块进的是当前正在用的tc，
+   可能是别的标签的，块会先被那个标签复用，tc把块还给cc时才转交回原来标签的cc，span和统计不会错 */
+class ConcurrentTagScope
+{
+public:
+    explicit ConcurrentTagScope(size_t tag)
+        : _prev(pTLSThreadCache)
+    {
+        pTLSThreadCache = GetTagCache(tag);
+    }
+
+    ~ConcurrentTagScope()
+    {
+        pTLSThreadCache = _prev;
+    }
+
+    ConcurrentTagScope(const ConcurrentTagScope& copy) = delete;
+    ConcurrentTagScope& operator=(const ConcurrentTagScope& copy) = delete;
+
+private:
+    ThreadCache* _prev;
+};
+
+// 申请size大小的空间，记在tag标签下，用ConcurrentFree释放
+void* ConcurrentAllocTagged(size_t size, size_t tag)
+{
+    ConcurrentTagScope scope(tag);
+    return ConcurrentAlloc(size);
+}
+
+// tag标签当前占用的字节数，是这个标签的span的字节数之和
+size_t ConcurrentTagBytes(size_t tag)
+{
+    return GetTagStats(tag)._bytes.load(std::memory_order_relaxed);
+}
+
+// tag标签占用字节数的最大值
+size_t ConcurrentTagPeakBytes(size_t tag)
+{
+    return GetTagStats(tag)._peak.load(std::memory_order_relaxed);
+}
+
+/* 设置tag标签的预算，单位字节，0表示没有预算
+   标签要多占一个span时超出预算，就交给预算回调决定，没有回调时这次申请抛出std::bad_alloc
+   预算按span检查，从tc和cc中已有的块申请不会触发 */
+void ConcurrentSetTagBudget(size_t tag, size_t bytes)
+{
+    GetTagStats(tag)._budget.store(bytes, std::memory_order_relaxed);
+}
+
+// 设置超出预算的回调，所有标签共用一个，返回之前的回调
+ConcurrentTagBudgetHandler ConcurrentSetTagBudgetHandler(ConcurrentTagBudgetHandler handler)
+{
+    return s_tagBudgetHandler.exchange(handler, std::memory_order_acq_rel);
+}
+
+/* 读者的临界区：对象存在期间，当前线程可以安全地访问无锁数据结构中的节点，
+   别的线程在这期间摘下来并ConcurrentRetire的节点，要等当前线程离开临界区之后才会被复用，可以嵌套 */
+class ConcurrentEpochGuard
+{
+public:
+    ConcurrentEpochGuard()
+        : _record(GetEpochRecord())
+    {
+        if (_record->_depth++ == 0)
+        {
+            size_t epoch = EpochManager::GetInstance()->Epoch();
+            _record->_state.store((epoch << 1) | 1, std::memory_order_seq_cst);
+        }
+    }
+
+    ~ConcurrentEpochGuard()
+    {
+        if (--_record->_depth == 0)
+        {
+            _record->_state.store(0, std::memory_order_release);
+        }
     }
 
-}
\ No newline at end of file
+    ConcurrentEpochGuard(const ConcurrentEpochGuard& copy) = delete;
+    ConcurrentEpochGuard& operator=(const ConcurrentEpochGuard& copy) = delete;
+
+private:
+    EpochRecord* _record;
+};
+
+/* ptr已经从无锁数据结构中摘下来了，读者可能还在访问它，不能马上ConcurrentFree
+   先攒在当前线程的tc中，等摘下来时已经在临界区里的读者都出来了，再成批放回tc的自由链表
+   只回收空间，不调用析构函数 */
+void ConcurrentRetire(void* ptr)
+{
+    assert(ptr);
+    GetThreadCache()->Retire(ptr);
+}
+
+/* 等所有读者离开它们现在所在的临界区，把当前线程退休的对象全部放回自由链表，不能在ConcurrentEpochGuard里调用
+   退出的线程留下的还不安全的退休对象也会一起放回当前线程的tc，线程退出之前不调用也不会泄漏 */
+void ConcurrentSynchronize()
+{
+    assert(GetEpochRecord()->_depth == 0);
+
+    GetThreadCache();   // 没有tc时也建一个，收下退出的线程留下的退休对象
+
+    for (size_t tag = 0; tag < TAG_NUM; ++tag)
+    {
+        if (pTLSTagCaches[tag] != nullptr)
+        {
+            pTLSTagCaches[tag]->ReclaimRetired(true);
+        }
+    }
+}
+
+// Heap对象本身也用定长内存池来申请
+static ObjectPool<Heap>& HeapPool()
+{
+    static ObjectPool<Heap> heapPool;
+    return heapPool;
+}
+
+// 创建一个独立的Heap，monotonic为true时是单调模式，对象不能单独释放
+Heap* HeapCreate(bool monotonic = false)
+{
+    std::lock_guard<PoolMutex> lock(HeapPool()._poolMtx);
+    return HeapPool().New(monotonic);
+}
+
+// 从heap中申请size大小的空间，heap同一时间只能被一个线程使用
+void* HeapAlloc(Heap* heap, size_t size)
+{
+    assert(heap);
+    return heap->Allocate(size);
+}
+
+// 把ptr还给heap，ptr必须是从这个heap中申请的
+void HeapFree(Heap* heap, void* ptr)
+{
+    assert(heap);
+    heap->Deallocate(ptr);
+}
+
+// 销毁heap，heap中所有还没释放的对象一起失效，所有span一次性还给pc
+void HeapDestroy(Heap* heap)
+{
+    assert(heap);
+
+    // 先在锁外把span还回去，再回收Heap对象本身
+    heap->Release();
+
+    std::lock_guard<PoolMutex> lock(HeapPool()._poolMtx);
+    HeapPool().Delete(heap);
+}
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+
+// 共享分配域的句柄也用定长内存池来申请
+static ObjectPool<SharedHeap>& SharedHeapPool()
+{
+    static ObjectPool<SharedHeap> sharedHeapPool;
+    return sharedHeapPool;
+}
+
+/* 创建一个bytes字节的共享分配域
+   name为nullptr时用匿名的memfd，fork出来的子进程直接可以用，其他进程要通过SharedHeapFd拿到fd再Attach
+   name不为空时用shm_open创建，其他进程可以通过SharedHeapOpen(name)打开，已经存在时返回nullptr */
+SharedHeap* SharedHeapCreate(size_t bytes, const char* name = nullptr)
+{
+    bytes = SizeClass::_RoundUp(bytes, 1 << PAGE_SHIFT);
+
+    int fd = -1;
+    if (name != nullptr)
+    {
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    else
+    {
+#ifdef __linux__
+        fd = memfd_create("ConcurrentMemoryPool", MFD_CLOEXEC);
+#else
+        // 没有memfd的系统上用一个临时的名字，打开之后马上删掉
+        char tmp[64];
+        snprintf(tmp, sizeof(tmp), "/ConcurrentMemoryPool.%d.%p", (int)getpid(), (void*)&bytes);
+        fd = shm_open(tmp, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0)
+        {
+            shm_unlink(tmp);
+        }
+#endif
+    }
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    // 新的共享内存全是0，用的时候才占物理内存
+    if (ftruncate(fd, (off_t)bytes) != 0)
+    {
+        close(fd);
+        if (name != nullptr)
+        {
+            shm_unlink(name);
+        }
+        return nullptr;
+    }
+
+    try
+    {
+        std::lock_guard<PoolMutex> lock(SharedHeapPool()._poolMtx);
+        return SharedHeapPool().New(fd, bytes, true);
+    }
+    catch (const std::bad_alloc&)
+    {// 地址空间不够，或者bytes太小建不成分配域，名字也删掉，不然再建时会因为已经存在而失败
+        close(fd);
+        if (name != nullptr)
+        {
+            shm_unlink(name);
+        }
+        return nullptr;
+    }
+}
+
+// 通过fd映射别的进程创建的共享分配域，fd会被复制一份，调用者可以关掉自己的fd，不是共享分配域时返回nullptr
+SharedHeap* SharedHeapAttach(int fd)
+{
+    int dupFd = dup(fd);
+    if (dupFd < 0)
+    {
+        return nullptr;
+    }
+
+    std::lock_guard<PoolMutex> lock(SharedHeapPool()._poolMtx);
+    SharedHeap* heap = nullptr;
+    try
+    {
+        heap = SharedHeapPool().New(dupFd, 0, false);
+    }
+    catch (const std::bad_alloc&)
+    {// 空文件或者映射不上
+        close(dupFd);
+        return nullptr;
+    }
+    if (!heap->Valid())
+    {
+        SharedHeapPool().Delete(heap);
+        return nullptr;
+    }
+    return heap;
+}
+
+// 打开SharedHeapCreate(bytes, name)创建的共享分配域，不存在时返回nullptr
+SharedHeap* SharedHeapOpen(const char* name)
+{
+    int fd = shm_open(name, O_RDWR, 0600);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    SharedHeap* heap = SharedHeapAttach(fd);
+    close(fd);
+    return heap;
+}
+
+// 当前进程不再使用共享分配域，区域中的对象不受影响，最后一个进程解除映射后区域才会被回收
+void SharedHeapDetach(SharedHeap* heap)
+{
+    assert(heap);
+
+    std::lock_guard<PoolMutex> lock(SharedHeapPool()._poolMtx);
+    SharedHeapPool().Delete(heap);
+}
+
+// 删除SharedHeapCreate(bytes, name)创建的名字，已经打开的进程不受影响
+void SharedHeapUnlink(const char* name)
+{
+    shm_unlink(name);
+}
+
+// 从共享分配域中申请size大小的空间，可以被多个进程、多个线程同时调用
+void* SharedHeapAlloc(SharedHeap* heap, size_t size)
+{
+    assert(heap);
+    return heap->Allocate(size == 0 ? 1 : size);
+}
+
+// 把ptr还给共享分配域，ptr可以是任何一个进程申请的
+void SharedHeapFree(SharedHeap* heap, void* ptr)
+{
+    assert(heap);
+    heap->Deallocate(ptr);
+}
+
+// 每个进程映射的地址不一样，对象在进程之间要通过偏移量传递
+size_t SharedHeapOffset(SharedHeap* heap, const void* ptr)
+{
+    assert(heap);
+    return heap->ToOffset(ptr);
+}
+
+void* SharedHeapPointer(SharedHeap* heap, size_t offset)
+{
+    assert(heap);
+    return heap->ToPointer(offset);
+}
+
+int SharedHeapFd(SharedHeap* heap)
+{
+    assert(heap);
+    return heap->Fd();
+}
+
+// 设置/获取根对象，持久化分配域重新打开之后通过根对象找到原来的数据结构
+void SharedHeapSetRoot(SharedHeap* heap, void* root)
+{
+    assert(heap);
+    heap->SetRoot(root);
+}
+
+void* SharedHeapRoot(SharedHeap* heap)
+{
+    assert(heap);
+    return heap->Root();
+}
+
+/* 打开文件path作为持久化分配域，同一时间只能有一个进程打开
+   文件不存在或者是空的：建一个bytes字节的分配域，映射到base(nullptr表示PERSISTENT_HEAP_BASE)
+   文件已经是分配域：映射到建好时的地址，bytes和base都不用，对象原样都在，不会重新申请
+   上一个进程是崩溃退出的，打开时会修复分配器的元数据
+   文件打不开、已经被别的进程打开了、不是分配域、bytes太小或者地址被占用时返回nullptr */
+SharedHeap* PersistentHeapOpen(const char* path, size_t bytes = 0, void* base = nullptr)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    // 进程退出时文件锁会自动释放，崩溃之后也能再打开
+    struct stat st;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    // 先只读出头部，拿到建好时的地址和大小
+    alignas(SharedHeapHeader) char buf[sizeof(SharedHeapHeader)] = { 0 };
+    SharedHeapHeader* header = (SharedHeapHeader*)buf;
+    if (st.st_size > 0 && pread(fd, buf, sizeof(buf), 0) != (ssize_t)sizeof(buf))
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    // 空文件，或者上次建分配域的时候还没写magic就崩溃了，里面没有任何对象，重新建
+    bool format = header->_magic == 0;
+    if (format)
+    {
+        bytes = st.st_size > 0 ? (size_t)st.st_size : SizeClass::_RoundUp(bytes, 1 << PAGE_SHIFT);
+        base = base != nullptr ? base : (void*)PERSISTENT_HEAP_BASE;
+        // 太小建不成分配域时文件不能先被改大小
+        if (!SharedHeap::Formattable(bytes) || ftruncate(fd, (off_t)bytes) != 0)
+        {
+            close(fd);
+            return nullptr;
+        }
+    }
+    else if (header->_magic != SHARED_HEAP_MAGIC || header->_bytes != (size_t)st.st_size)
+    {
+        close(fd);
+        return nullptr;
+    }
+    else
+    {
+        bytes = header->_bytes;
+        base = (void*)header->_baseAddress;
+    }
+
+    SharedHeap* heap = nullptr;
+    try
+    {
+        std::lock_guard<PoolMutex> lock(SharedHeapPool()._poolMtx);
+        heap = SharedHeapPool().New(fd, bytes, format, base);
+    }
+    catch (const std::bad_alloc&)
+    {// 地址被占用了
+        close(fd);
+        return nullptr;
+    }
+
+    heap->Recover();
+    return heap;
+}
+
+// 把持久化分配域写回文件并关闭
+void PersistentHeapClose(SharedHeap* heap)
+{
+    assert(heap);
+    heap->Sync();
+    SharedHeapDetach(heap);
+}
+#endif
+
+// 当前线程接下来一段时间不会再申请，把tc中缓存的块都还回去，包括每个标签的tc
+void ConcurrentThreadIdle()
+{
+    ReleaseThreadCaches();
+}
+
+/* 把内存池中空闲的内存还给系统，pc最多留下keepBytes字节还占着物理内存的空闲空间
+   返回还给系统的字节数，不会动各个线程tc中缓存的块 */
+size_t ConcurrentTrim(size_t keepBytes = 0)
+{
+    // cc中还没用过的span先还给pc，pc再把空闲页还给系统
+    return CentralCache::GetInstance()->Trim(keepBytes);
+}
+
+/* 设置堆的软上限和硬上限，单位字节，(size_t)-1表示没有上限
+   堆的大小是分配出去的span、大块缓存和还占着物理内存的空闲页的字节数之和
+   超过软上限之后会回收空闲内存，超过硬上限的申请先回收再重试，还是不够就交给OOM回调或者抛出std::bad_alloc */
+void ConcurrentSetLimits(size_t softBytes, size_t hardBytes)
+{
+    std::lock_guard<PageMutex> lock(PageCache::GetInstance()->_pageMtx);
+    PageCache::GetInstance()->SetLimits(softBytes, hardBytes);
+}
+
+// 当前堆的大小
+size_t ConcurrentHeapBytes()
+{
+    std::lock_guard<PageMutex> lock(PageCache::GetInstance()->_pageMtx);
+    return PageCache::GetInstance()->HeapBytes();
+}
+
+// 设置OOM回调，返回之前的回调
+ConcurrentOomHandler ConcurrentSetOomHandler(ConcurrentOomHandler handler)
+{
+    return s_oomHandler.exchange(handler, std::memory_order_acq_rel);
+}
+
+/* 按所在cgroup的memory.max设置上限：软上限softRatio * memory.max，硬上限hardRatio * memory.max
+   cgroup的限制还包括程序的代码、栈和其他分配器的内存，所以比例要留出余量
+   不在cgroup v2中或者没有限制时返回false，不修改上限 */
+bool ConcurrentSetLimitsFromCgroup(double softRatio = 0.8, double hardRatio = 0.95)
+{
+    assert(softRatio <= hardRatio);
+
+    size_t max = CgroupMemoryMax();
+    if (max == 0)
+    {
+        return false;
+    }
+
+    ConcurrentSetLimits((size_t)(max * softRatio), (size_t)(max * hardRatio));
+    return true;
+}
+
+// 后台线程看到系统内存压力(PSI的some avg10)超过percent%时回收空闲内存，0表示不看
+void ConcurrentSetPressureThreshold(double percent)
+{
+    Maintenance::GetInstance()->SetPressureThreshold(percent);
+}
+
+// 启动后台维护线程，每intervalMs毫秒醒来一次
+void ConcurrentBackgroundStart(size_t intervalMs = 10)
+{
+    Maintenance::GetInstance()->Start(intervalMs);
+}
+
+// 停止后台维护线程，之后所有工作回到申请/释放的线程上当场完成
+void ConcurrentBackgroundStop()
+{
+    Maintenance::GetInstance()->Stop();
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+/* 让STL容器使用内存池：
+   ConcurrentMemoryResource是std::pmr::memory_resource，给std::pmr容器用
+   ConcurrentAllocator<T>是无状态的分配器，直接作为容器的模板参数
+*/
+
+#include <new>
+#include <memory>
+#include <memory_resource>
+#include "ConcurrentAlloc.h"
+
+/* 按对齐要求调整实际向内存池申请的大小
+   块的地址 = span首地址(按页对齐) + 着色的偏移(块大小的对齐数的倍数) + i * 块大小，
+   所以块大小是对齐数的倍数时，块地址就满足对齐要求
+*/
+constexpr size_t AlignedRequestSize(size_t bytes, size_t alignment)
+{
+    if (bytes == 0)
+    {
+        bytes = 1;  // 内存池不支持申请0字节
+    }
+
+    if (alignment <= 8)
+    {// 所有块都至少按8B对齐
+        return bytes;
+    }
+
+    // 先凑成对齐数的倍数，所在桶的块大小也是对齐数的倍数就可以直接用（大块空间按页对齐）
+    size_t size = SizeClass::_RoundUp(bytes, alignment);
+    if (size > MAX_BYTES || SizeClass::RoundUp(size) % alignment == 0)
+    {
+        return size;
+    }
+
+    // 否则凑成2的幂，2的幂一定正好是一个桶的块大小
+    size = alignment;
+    while (size < bytes)
+    {
+        size <<= 1;
+    }
+    return size;
+}
+
+// 带对齐要求的申请，对齐数超过一页时内存池无法保证，交给系统的operator new
+inline void* ConcurrentAlignedAlloc(size_t bytes, size_t alignment)
+{
+    if (alignment > ((size_t)1 << PAGE_SHIFT))
+    {
+        return ::operator new(bytes, std::align_val_t(alignment));
+    }
+
+    return ConcurrentAlloc(AlignedRequestSize(bytes, alignment));
+}
+
+// 和ConcurrentAlignedAlloc配对的释放，bytes和alignment必须和申请时一致
+inline void ConcurrentAlignedFree(void* ptr, size_t bytes, size_t alignment)
+{
+    if (alignment > ((size_t)1 << PAGE_SHIFT))
+    {
+        ::operator delete(ptr, std::align_val_t(alignment));
+        return;
+    }
+
+    // 释放时知道大小，走带大小的释放，小块空间不用再查span
+    ConcurrentFree(ptr, AlignedRequestSize(bytes, alignment));
+}
+
+// 一个T对象实际向内存池申请的大小，编译期算好
+template<class T>
+constexpr size_t ConcurrentObjectSize()
+{
+    static_assert(alignof(T) <= ((size_t)1 << PAGE_SHIFT), "对齐数超过一页的类型不能用内存池");
+    return AlignedRequestSize(sizeof(T), alignof(T));
+}
+
+// 相当于new T(args...)，大小在编译期确定，走ConcurrentAlloc<N>的快路径
+template<class T, class... Args>
+T* ConcurrentNew(Args&&... args)
+{
+    void* ptr = ConcurrentAlloc<ConcurrentObjectSize<T>()>();
+    try
+    {
+        return new (ptr) T(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {// 构造函数抛异常时空间要还回去
+        ConcurrentFree<ConcurrentObjectSize<T>()>(ptr);
+        throw;
+    }
+}
+
+// 相当于delete ptr，ptr必须是ConcurrentNew<T>返回的，T必须是对象的实际类型，不能是基类
+template<class T>
+void ConcurrentDelete(T* ptr)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+    ptr->~T();
+    ConcurrentFree<ConcurrentObjectSize<T>()>((void*)ptr);
+}
+
+// std::pmr的内存资源，所有实例都是等价的
+class ConcurrentMemoryResource : public std::pmr::memory_resource
+{
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        return ConcurrentAlignedAlloc(bytes, alignment);
+    }
+
+    void do_deallocate(void* ptr, size_t bytes, size_t alignment) override
+    {
+        ConcurrentAlignedFree(ptr, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return dynamic_cast<const ConcurrentMemoryResource*>(&other) != nullptr;
+    }
+};
+
+// 全局的内存资源，可以直接传给std::pmr容器或者设置成默认资源
+inline ConcurrentMemoryResource* ConcurrentResource()
+{
+    static ConcurrentMemoryResource resource;
+    return &resource;
+}
+
+// 无状态的STL分配器
+template<class T>
+class ConcurrentAllocator
+{
+public:
+    typedef T value_type;
+
+    ConcurrentAllocator() noexcept {}
+
+    template<class U>
+    ConcurrentAllocator(const ConcurrentAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n)
+    {
+        if (n > (size_t)-1 / sizeof(T))
+        {
+            throw std::bad_array_new_length();
+        }
+        if constexpr (alignof(T) <= ((size_t)1 << PAGE_SHIFT))
+        {
+            if (n == 1)
+            {// 节点型容器每次只申请一个节点，大小是编译期常量
+                return (T*)ConcurrentAlloc<ConcurrentObjectSize<T>()>();
+            }
+        }
+        return (T*)ConcurrentAlignedAlloc(n * sizeof(T), alignof(T));
+    }
+
+#ifdef __cpp_lib_allocate_at_least
+    // C++23：把桶大小多出来的部分也交给容器，容器可以少扩容几次
+    std::allocation_result<T*> allocate_at_least(size_t n)
+    {
+        if (alignof(T) > 8)
+        {// 有对齐要求时申请的大小已经调整过，按原来的方式申请
+            return { allocate(n), n };
+        }
+        if (n > (size_t)-1 / sizeof(T))
+        {
+            throw std::bad_array_new_length();
+        }
+
+        size_t usable = 0;
+        T* ptr = (T*)ConcurrentAllocAtLeast(n ? n * sizeof(T) : 1, usable);
+        return { ptr, usable / sizeof(T) };
+    }
+#endif
+
+    void deallocate(T* ptr, size_t n) noexcept
+    {
+        if constexpr (alignof(T) <= ((size_t)1 << PAGE_SHIFT))
+        {
+            if (n == 1)
+            {
+                ConcurrentFree<ConcurrentObjectSize<T>()>(ptr);
+                return;
+            }
+        }
+        ConcurrentAlignedFree(ptr, n * sizeof(T), alignof(T));
+    }
+};
+
+// 无状态，任意两个分配器都可以互相释放对方申请的空间
+template<class T, class U>
+bool operator==(const ConcurrentAllocator<T>&, const ConcurrentAllocator<U>&) noexcept
+{
+    return true;
+}
+
+template<class T, class U>
+bool operator!=(const ConcurrentAllocator<T>&, const ConcurrentAllocator<U>&) noexcept
+{
+    return false;
+}
@@ -0,0 +1,72 @@
+#include "Epoch.h"
+
+EpochManager EpochManager::_sInst;  // EpochManager的饿汉对象
+
+// 给当前线程一条记录
+EpochRecord* EpochManager::Acquire()
+{
+    // 先找退出的线程留下的记录
+    for (EpochRecord* it = _records.load(std::memory_order_acquire); it != nullptr; it = it->_next)
+    {
+        bool expected = false;
+        if (!it->_inUse.load(std::memory_order_relaxed)
+            && it->_inUse.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        {
+            return it;
+        }
+    }
+
+    // 没有就新建一条，头插到链表中，记录永远不会从链表中删掉，遍历的线程不用加锁
+    static ObjectPool<EpochRecord> recordPool;
+    recordPool._poolMtx.lock();
+    EpochRecord* record = recordPool.New();
+    recordPool._poolMtx.unlock();
+    record->_inUse.store(true, std::memory_order_relaxed);
+
+    EpochRecord* head = _records.load(std::memory_order_relaxed);
+    do
+    {
+        record->_next = head;
+    } while (!_records.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+
+    return record;
+}
+
+// 线程退出时交还记录
+void EpochManager::Release(EpochRecord* record)
+{
+    assert(record->_depth == 0);    // 不能在临界区里退出线程
+    record->_state.store(0, std::memory_order_seq_cst);
+    record->_inUse.store(false, std::memory_order_release);
+}
+
+// 在临界区里的读者都看到了当前的epoch时把全局epoch加1
+size_t EpochManager::TryAdvance()
+{
+    size_t epoch = _epoch.load(std::memory_order_seq_cst);
+    for (EpochRecord* it = _records.load(std::memory_order_acquire); it != nullptr; it = it->_next)
+    {
+        size_t state = it->_state.load(std::memory_order_seq_cst);
+        if ((state & 1) && (state >> 1) != epoch)
+        {// 还有读者停在之前的epoch，摘下来的节点可能还在被它访问
+            return epoch;
+        }
+    }
+
+    // 失败说明别的线程已经推进过了，epoch被更新成最新的值
+    if (_epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst))
+    {
+        ++epoch;
+    }
+    return epoch;
+}
+
+// 线程退出时留下还不安全的批
+void EpochManager::Orphan(RetireBatch* head, RetireBatch* tail)
+{
+    RetireBatch* old = _orphans.load(std::memory_order_relaxed);
+    do
+    {
+        tail->_next = old;
+    } while (!_orphans.compare_exchange_weak(old, head, std::memory_order_release, std::memory_order_relaxed));
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "Common.h"
+
+/* 基于epoch的延迟释放，给无锁数据结构用：
+   读者在ConcurrentEpochGuard里遍历，进来时记下当时的全局epoch
+   写者把节点从数据结构中摘下来之后调用ConcurrentRetire，节点先攒在线程的tc中，攒满一批封存，记下封存时的全局epoch
+   所有在临界区里的读者都看到了当前的全局epoch，全局epoch才能加1，
+   所以全局epoch比一批的epoch大2之后，摘下这些节点时已经在临界区里的读者都出来了，整批放回tc的自由链表
+*/
+
+static const size_t RETIRE_BATCH_NUM = 64;  // 一批最多攒多少个退休的对象
+
+/* 一批退休的对象
+   退休时对象可能还在被读者访问，不能像空闲块那样往对象里写链表指针，所以指针单独存在这里 */
+struct RetireBatch
+{
+    void* _ptrs[RETIRE_BATCH_NUM];
+    size_t _n = 0;
+    size_t _epoch = 0;      // 封存时的全局epoch
+    RetireBatch* _next = nullptr;
+};
+
+// 每个线程一条记录，读者在不在临界区里、进来时看到的是哪个epoch
+struct alignas(CACHE_LINE) EpochRecord
+{
+    std::atomic<size_t> _state{ 0 };    // 不在临界区里是0，否则是(epoch << 1) | 1
+    size_t _depth = 0;                  // 临界区嵌套的层数，只有所属的线程访问
+    std::atomic<bool> _inUse{ false };  // 有没有线程在用，线程退出后记录留给新线程复用
+    EpochRecord* _next = nullptr;       // 所有记录串成一个只增不减的链表
+};
+
+class EpochManager
+{
+public:
+    // 单例接口
+    static EpochManager* GetInstance()
+    {
+        return &_sInst;
+    }
+
+    size_t Epoch()
+    {
+        return _epoch.load(std::memory_order_seq_cst);
+    }
+
+    // epoch时封存的一批对象是不是已经没有读者能看到了
+    bool Safe(size_t epoch)
+    {
+        return Epoch() >= epoch + 2;
+    }
+
+    // 给当前线程一条记录，优先复用退出的线程留下的
+    EpochRecord* Acquire();
+
+    // 线程退出时交还记录
+    void Release(EpochRecord* record);
+
+    // 在临界区里的读者都看到了当前的epoch时把全局epoch加1，返回最新的全局epoch
+    size_t TryAdvance();
+
+    // 线程退出时还不安全的批[head, tail]整串挂过来，之后由别的线程回收
+    void Orphan(RetireBatch* head, RetireBatch* tail);
+
+    // 取走退出的线程留下的所有批，没有时返回nullptr
+    RetireBatch* TakeOrphans()
+    {
+        if (_orphans.load(std::memory_order_relaxed) == nullptr)
+        {
+            return nullptr;
+        }
+        return _orphans.exchange(nullptr, std::memory_order_acquire);
+    }
+
+private:
+    // 构造函数私有化，constexpr的构造函数让_sInst在编译期就初始化好
+    constexpr EpochManager() {}
+
+    EpochManager(const EpochManager& copy) = delete;
+    EpochManager& operator=(const EpochManager& copy) = delete;
+
+    std::atomic<size_t> _epoch{ 1 };
+    std::atomic<EpochRecord*> _records{ nullptr };
+    std::atomic<RetireBatch*> _orphans{ nullptr };  // 只会整串挂上、整串取走，不存在ABA问题
+    static EpochManager _sInst;
+};
+
+// 线程退出时把记录交还给EpochManager
+struct EpochRecordHolder
+{
+    EpochRecord* _record = nullptr;
+
+    ~EpochRecordHolder()
+    {
+        if (_record != nullptr)
+        {
+            EpochManager::GetInstance()->Release(_record);
+        }
+    }
+};
+
+static thread_local EpochRecordHolder tlsEpochRecord;
+
+// 当前线程的记录，第一次调用时拿一条
+static inline EpochRecord* GetEpochRecord()
+{
+    if (tlsEpochRecord._record == nullptr)
+    {
+        tlsEpochRecord._record = EpochManager::GetInstance()->Acquire();
+    }
+    return tlsEpochRecord._record;
+}
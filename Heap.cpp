@@ -0,0 +1,136 @@
+#include "Heap.h"
+#include "PageCache.h"
+
+// 单调模式下每次至少向pc拿多少页
+static const size_t HEAP_CHUNK_PAGES = 16;
+
+// 从pc拿一个k页的span，挂到_spans中统一管理
+Span* Heap::NewSpan(size_t k, size_t objSize)
+{
+    // 超过硬上限时NewSpan会抛异常，用智能锁
+    std::unique_lock<PageMutex> lc(PageCache::GetInstance()->_pageMtx);
+    Span* span = PageCache::GetInstance()->NewSpan(k);
+    span->_isUse = true;        // 和cc中的span一样，不能被pc合并
+    span->_objSize = objSize;
+    lc.unlock();
+
+    // Heap的span不在cc中，_next和_prev可以直接拿来挂到_spans上
+    _spans.PushFront(span);
+
+    return span;
+}
+
+void* Heap::Allocate(size_t size)
+{
+    if (size > MAX_BYTES)
+    {
+        return AllocateLarge(size);
+    }
+
+    if (_monotonic)
+    {
+        return AllocateMonotonic(size);
+    }
+
+    size_t alignSize = SizeClass::RoundUp(size);
+    size_t index = SizeClass::Index(size);
+
+    if (_freeLists[index].Empty())
+    {// 自由链表为空，直接从pc拿一个span，整个切好挂进来
+        Span* span = NewSpan(SizeClass::NumMovePage(alignSize), alignSize);
+
+        char* start = (char*)(span->_pageId << PAGE_SHIFT);
+        size_t n = (span->_n << PAGE_SHIFT) / alignSize;
+
+        void* tail = start;
+        for (size_t i = 1; i < n; ++i)
+        {
+            ObjNext(tail) = (char*)tail + alignSize;
+            tail = ObjNext(tail);
+        }
+
+        _freeLists[index].PushRange(start, tail, n);
+    }
+
+    return _freeLists[index].Pop();
+}
+
+// 单调模式下的申请
+void* Heap::AllocateMonotonic(size_t size)
+{
+    // 16B及以上的对象按16B对齐，小对象按8B对齐
+    size_t align = size >= 16 ? 16 : 8;
+    size_t alignSize = SizeClass::_RoundUp(size, align);
+
+    if (_cur == nullptr || (size_t)(_end - _cur) < alignSize)
+    {// 当前span剩下的空间不够了，剩下的直接丢掉，换一个新的span
+        size_t k = std::max(HEAP_CHUNK_PAGES, SizeClass::_RoundUp(alignSize, 1 << PAGE_SHIFT) >> PAGE_SHIFT);
+        Span* span = NewSpan(k, 0);
+
+        _cur = (char*)(span->_pageId << PAGE_SHIFT);
+        _end = _cur + (span->_n << PAGE_SHIFT);
+    }
+
+    void* obj = _cur;
+    _cur += alignSize;
+
+    return obj;
+}
+
+// 申请超过256KB的空间
+void* Heap::AllocateLarge(size_t size)
+{
+    size_t k = SizeClass::RoundUp(size) >> PAGE_SHIFT;
+    Span* span = NewSpan(k, k << PAGE_SHIFT);
+
+    return (void*)(span->_pageId << PAGE_SHIFT);
+}
+
+void Heap::Deallocate(void* obj)
+{
+    assert(obj);
+
+    Span* span = PageCache::GetInstance()->MapObjectToSpan(obj);
+
+    if (span->_objSize > MAX_BYTES)
+    {// 大块空间直接还给pc，不用等到Release
+        _spans.Erase(span);
+        span->_next = span->_prev = nullptr;
+
+        PageCache::GetInstance()->_pageMtx.lock();
+        PageCache::GetInstance()->ReleaseSpanToPageCache(span);
+        PageCache::GetInstance()->_pageMtx.unlock();
+    }
+    else if (!_monotonic)
+    {
+        _freeLists[SizeClass::Index(span->_objSize)].Push(obj);
+    }
+    // 单调模式下小对象不单独回收，等Release时随span一起还回去
+}
+
+// 把Heap拿到的所有span还给pc
+void Heap::Release()
+{
+    // 自由链表中的块都在_spans管理的span中，直接丢掉即可
+    for (size_t i = 0; i < FREE_LIST_NUM; ++i)
+    {
+        _freeLists[i].Clear();
+    }
+    _cur = _end = nullptr;
+
+    if (_spans.Empty())
+    {
+        return;
+    }
+
+    // 所有span一次加锁全部还回去
+    PageCache::GetInstance()->_pageMtx.lock();
+    while (!_spans.Empty())
+    {
+        Span* span = _spans.PopFront();
+        span->_next = span->_prev = nullptr;
+        span->_freeList = nullptr;
+        PageCache::GetInstance()->ReleaseSpanToPageCache(span);
+    }
+    PageCache::GetInstance()->_pageMtx.unlock();
+}
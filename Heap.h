@@ -0,0 +1,45 @@
+#pragma once
+#include "Common.h"
+
+/* 独立的分配域：一个Heap自己维护自由链表，直接从pc拿span，
+   用完之后通过Release把所有span一次性还给pc，不需要逐个释放对象
+   Heap和tc一样不加锁，同一时间只能由一个线程使用
+*/
+class Heap
+{
+public:
+    // monotonic为true时是单调模式：只顺序切分空间，Deallocate什么都不做
+    Heap(bool monotonic = false)
+        : _monotonic(monotonic)
+    {}
+
+    ~Heap()
+    {
+        Release();
+    }
+
+    void* Allocate(size_t size);    // 从当前Heap中申请size大小的空间
+
+    void Deallocate(void* obj);     // 把obj还给当前Heap
+
+    // 把Heap拿到的所有span还给pc，复杂度只和span个数有关
+    void Release();
+
+private:
+    // 从pc拿一个k页的span，挂到_spans中统一管理
+    Span* NewSpan(size_t k, size_t objSize);
+
+    // 单调模式下的申请：在当前span中顺序往后切
+    void* AllocateMonotonic(size_t size);
+
+    // 申请超过256KB的空间，单独占一个span
+    void* AllocateLarge(size_t size);
+
+private:
+    FreeList _freeLists[FREE_LIST_NUM];  // 和tc一样的哈希桶
+    SpanList _spans;    // 当前Heap拿到的所有span
+
+    bool _monotonic;    // 是否是单调模式
+    char* _cur = nullptr;   // 单调模式下当前span中还没有切出去的空间
+    char* _end = nullptr;
+};
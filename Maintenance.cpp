@@ -0,0 +1,185 @@
+#include <fstream>
+#include <string>
+#include "Maintenance.h"
+#include "CentralCache.h"
+#include "PageCache.h"
+
+Maintenance Maintenance::_sInst;
+
+// 每个桶最多提前切多少个span
+static const size_t PREFILL_SPAN_MAX = 4;
+
+// 桶连续这么多次没有需求，就把预先切好的span还回去
+static const size_t IDLE_TICKS = 100;
+
+// 每这么多次读一次PSI，PSI的avg10本身就是10秒的平均值，不用读得太勤
+static const size_t PRESSURE_TICKS = 100;
+
+// 当前进程所在cgroup(v2)中名为name的文件，不在cgroup v2中返回空串
+static std::string CgroupFile(const char* name)
+{
+    std::ifstream in("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.compare(0, 3, "0::") == 0)
+        {// cgroup v2的那一行是 0::/路径
+            std::string dir = "/sys/fs/cgroup" + line.substr(3);
+            if (dir.back() != '/')
+            {
+                dir += '/';
+            }
+            return dir + name;
+        }
+    }
+    return "";
+}
+
+// cgroup的memory.max，没有限制或者读不到返回0
+static size_t CgroupMemoryMax()
+{
+    std::string path = CgroupFile("memory.max");
+    if (path.empty())
+    {
+        return 0;
+    }
+
+    std::ifstream in(path);
+    std::string value;
+    if (!(in >> value) || value == "max")
+    {
+        return 0;
+    }
+    return (size_t)std::stoull(value);
+}
+
+// 内存压力：some avg10，也就是最近10秒内有线程因为等内存而停顿的时间占比(%)，读不到返回-1
+static double MemoryPressure()
+{
+    // 优先看所在cgroup的，没有就看整个系统的
+    std::string path = CgroupFile("memory.pressure");
+    std::ifstream in(path.empty() ? "/proc/pressure/memory" : path);
+    if (!in)
+    {
+        in.clear();
+        in.open("/proc/pressure/memory");
+    }
+
+    // 第一行是 some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+    std::string kind, avg10;
+    if (!(in >> kind >> avg10) || kind != "some" || avg10.compare(0, 6, "avg10=") != 0)
+    {
+        return -1;
+    }
+    return std::stod(avg10.substr(6));
+}
+
+// 启动后台线程
+void Maintenance::Start(size_t intervalMs)
+{
+    assert(intervalMs > 0);
+
+    std::lock_guard<std::mutex> lock(_mtx);
+    _intervalMs = intervalMs;
+    if (_thread.joinable())
+    {
+        _cv.notify_one();   // 按新的间隔重新计时
+        return;
+    }
+
+    PageCache::GetInstance()->_pageMtx.lock();
+    PageCache::GetInstance()->SetBackground(true);
+    PageCache::GetInstance()->_pageMtx.unlock();
+
+    _stop = false;
+    _thread = std::thread(&Maintenance::Run, this);
+}
+
+// 通知后台线程退出并等待它结束
+void Maintenance::Stop()
+{
+    std::thread worker;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (!_thread.joinable())
+        {
+            return;
+        }
+        _stop = true;
+        worker = std::move(_thread);
+    }
+    _cv.notify_one();
+    worker.join();
+
+    // 关掉后台模式，延迟合并的span当场合并掉
+    PageCache::GetInstance()->_pageMtx.lock();
+    PageCache::GetInstance()->SetBackground(false);
+    PageCache::GetInstance()->_pageMtx.unlock();
+
+    // 预先切好的span也还回去
+    for (size_t i = 0; i < FREE_LIST_NUM; ++i)
+    {
+        CentralCache::GetInstance()->ReleaseIdleSpans(i);
+    }
+}
+
+// 后台线程的主循环
+void Maintenance::Run()
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    while (!_stop)
+    {
+        _cv.wait_for(lock, std::chrono::milliseconds(_intervalMs));
+        if (_stop)
+        {
+            break;
+        }
+
+        lock.unlock();
+        Tick();
+        lock.lock();
+    }
+}
+
+// 醒来一次要做的事
+void Maintenance::Tick()
+{
+    // pc：合并延迟的span，淘汰超时的大块缓存并把物理内存还给系统
+    PageCache::GetInstance()->_pageMtx.lock();
+    PageCache::GetInstance()->FlushDeferred();
+    PageCache::GetInstance()->TrimLargeCache();
+    bool overSoftLimit = PageCache::GetInstance()->OverSoftLimit();
+    PageCache::GetInstance()->_pageMtx.unlock();
+
+    // 系统内存压力大的时候和超过软上限一样处理
+    double threshold = _pressureThreshold.load(std::memory_order_relaxed);
+    if (threshold > 0 && ++_pressureTicks >= PRESSURE_TICKS)
+    {
+        _pressureTicks = 0;
+        overSoftLimit = overSoftLimit || MemoryPressure() >= threshold;
+    }
+
+    if (overSoftLimit || PageCache::GetInstance()->TakeSoftLimitHit())
+    {// 各个线程的tc只有它自己能动，后台线程只回收cc和pc中的，也不再预先切span
+        CentralCache::GetInstance()->Trim(0);
+        return;
+    }
+
+    // cc：按最近一段时间的需求给每个桶准备span
+    for (size_t i = 0; i < FREE_LIST_NUM; ++i)
+    {
+        size_t demand = CentralCache::GetInstance()->SpanDemand(i);
+        size_t recent = demand - _lastDemand[i];
+        _lastDemand[i] = demand;
+
+        if (recent > 0)
+        {
+            _idleTicks[i] = 0;
+            CentralCache::GetInstance()->Prefill(i, recent < PREFILL_SPAN_MAX ? recent : PREFILL_SPAN_MAX);
+        }
+        else if (++_idleTicks[i] == IDLE_TICKS)
+        {
+            CentralCache::GetInstance()->ReleaseIdleSpans(i);
+        }
+    }
+}
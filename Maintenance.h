@@ -0,0 +1,68 @@
+#pragma once
+#include <condition_variable>
+#include "Common.h"
+
+/* 后台维护线程：把慢路径上的工作从申请/释放的线程挪出来
+   1. 根据每个cc桶最近用掉的全新span个数，提前把span切好放进cc
+   2. 需求消失的桶，把预先切好还没用的span还给pc，让内存流向别的桶
+   3. pc中延迟的span合并、大块缓存的淘汰和物理内存的归还
+   4. 堆超过软上限或者系统内存压力(PSI)大的时候，把空闲内存还给系统
+   默认不启动，通过Start打开，Stop或者程序退出时干净地结束
+*/
+class Maintenance
+{
+public:
+    static Maintenance* GetInstance()
+    {
+        return &_sInst;
+    }
+
+    // 启动后台线程，每intervalMs毫秒醒来一次，已经启动时只修改间隔
+    void Start(size_t intervalMs);
+
+    // 通知后台线程退出并等待它结束
+    void Stop();
+
+    bool Running()
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _thread.joinable();
+    }
+
+    /* 内存压力最近10秒内有线程因为等内存而停顿的时间占比(PSI的some avg10)超过percent%时回收空闲内存
+       percent为0表示不看内存压力 */
+    void SetPressureThreshold(double percent)
+    {
+        _pressureThreshold.store(percent, std::memory_order_relaxed);
+    }
+
+private:
+    // 后台线程的主循环
+    void Run();
+
+    // 醒来一次要做的事
+    void Tick();
+
+    Maintenance() {}
+    ~Maintenance()
+    {
+        Stop();
+    }
+
+    Maintenance(const Maintenance& copy) = delete;
+    Maintenance& operator=(const Maintenance& copy) = delete;
+
+    std::thread _thread;
+    std::mutex _mtx;                // 保护下面三个成员
+    std::condition_variable _cv;
+    bool _stop = false;
+    size_t _intervalMs = 0;
+
+    size_t _lastDemand[FREE_LIST_NUM] = { 0 };  // 上一次醒来时每个桶的span需求
+    size_t _idleTicks[FREE_LIST_NUM] = { 0 };   // 每个桶连续多少次没有需求
+
+    std::atomic<double> _pressureThreshold{ 0 };
+    size_t _pressureTicks = 0;  // 距离上一次读PSI过了多少次
+
+    static Maintenance _sInst;
+};
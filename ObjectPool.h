@@ -3,6 +3,9 @@
 /* 定长内存池*/
 
 #include <iostream>
+#include <utility>
+#include "AllocLock.h"
+#include "Common.h"     // SystemAlloc
 using std::cout;
 using std::endl;
 
@@ -33,7 +36,8 @@ template<class T>
 class ObjectPool
 {
 public:
-    T* New()    // 申请一个T类型大小的空间
+    template<class... Args>
+    T* New(Args&&... args)    // 申请一个T类型大小的空间，args会转发给T的构造函数
     {
         T* obj = nullptr;   // 最终返回的空间
 
@@ -50,13 +54,14 @@ public:
             if (_remanentBytes < sizeof(T))     // 这样也包含剩余空间为0的情况
             {
                 _remanentBytes = 128 * 1024;    // 向系统申请128K的空间
-                
-                _memory = (char*)malloc(_remanentBytes);  
-                // _memory = (char*)SystemAlloc(_remanentBytes >> 13); // 使用系统调用接口申请16页内存
-                
-                if (_memory == nullptr) {   // 申请失败了抛出异常
-                    throw std::bad_alloc();
+                if (_remanentBytes < sizeof(T))
+                {// T比128K还大时至少要够一个
+                    _remanentBytes = (sizeof(T) + (1 << PAGE_SHIFT) - 1) & ~(((size_t)1 << PAGE_SHIFT) - 1);
                 }
+
+                // _memory = (char*)malloc(_remanentBytes);  
+                // 不用malloc，内存池不能依赖别的分配器，SystemAlloc失败时会抛异常
+                _memory = (char*)SystemAlloc(_remanentBytes >> PAGE_SHIFT); // 使用系统调用接口申请16页内存
             }
 
                 obj = (T*)_memory;  // 给定一个T类型的大小
@@ -66,7 +71,16 @@ public:
                 _remanentBytes -= objSize;    // 空间给出后_remanetBytes减少了T类型的大小
         }
     
-        new(obj)T;  // 通过定位new调用构造函数进行初始化
+        try
+        {
+            new(obj)T(std::forward<Args>(args)...);  // 通过定位new调用构造函数进行初始化
+        }
+        catch (...)
+        {// 构造失败时这块空间没有交出去，挂回自由链表
+            *(void**)obj = _freelist;
+            _freelist = obj;
+            throw;
+        }
 
         return obj;
     }
@@ -93,7 +107,7 @@ public:
     }
 
 public:
-    std::mutex _poolMtx;    // 防止ThreadCache申请时申请到空指针
+    PoolMutex _poolMtx;    // 防止ThreadCache申请时申请到空指针
 
 private:
     char* _memory = nullptr;    // 指向内存块的指针
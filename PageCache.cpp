@@ -1,108 +1,244 @@
+#include <chrono>
 #include "PageCache.h"
 
 PageCache PageCache::_sInst;    // 单例对象
 
-// pc从_spanLists中拿出来一个k页的span
-Span* PageCache::NewSpan(size_t k)
+// 一直超过软上限时，最多每这么多毫秒回收一次
+static const size_t SOFT_LIMIT_MS = 10;
+
+// 当前时间，单位ms
+static size_t NowMs()
 {
-    // // 申请页数一定是在[1, PAGE_NUM - 1]这个范围内
-    // assert(k > 0 && k < PAGE_NUM);
-    assert(k > 0);
+    return (size_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-    // 如果单次申请的页数超过128页，需要向OS申请，如果没有超过128页还可以向pc申请
-    if (k > PAGE_NUM - 1)
+#if RESERVE_ADDRESS_SPACE
+// 第一次向系统要页的时候预留地址空间，预留不到RESERVE_BYTES就减半再试
+void PageCache::Reserve()
+{
+    for (size_t size = RESERVE_BYTES; size >= std::min(RESERVE_BYTES, (size_t)1 << 30); size >>= 1)
     {
-        void* ptr = SystemAlloc(k);     // 直接向os申请
-        // Span* span = new Span;  // 开一个新的span，用来管理新的空间
-        Span* span = _spanPool.New();
+        char* base = (char*)SystemReserve(size);
+        if (base != nullptr)
+        {
+            // 先建好映射数组再公布范围，IsOurPointer看到范围时映射一定能用
+            _idSpanMap.Init((PageID)base >> PAGE_SHIFT, size >> PAGE_SHIFT);
+            _regionTop = base;
+            _regionBase.store(base, std::memory_order_release);
+            _regionEnd.store(base + size, std::memory_order_release);
+            return;
+        }
+    }
+}
+#endif
 
-        span->_pageId = ((PageID)ptr >> PAGE_SHIFT);    // 申请空间的对应页号
-        span->_n = k;   // 申请了多少页
+// 向系统要k页的空间，预留了地址空间时从预留的空间中取
+void* PageCache::AllocPages(size_t k)
+{
+#if RESERVE_ADDRESS_SPACE
+    if (!_reserved)
+    {// 只预留一次，预留失败(比如ulimit -v限制了虚拟地址空间)也不再重试
+        _reserved = true;
+        Reserve();
+    }
 
-        // 把这个span管理的首页映射到哈希中，后面删除这个span的时候能找到
-        _idSpanMap[span->_pageId] = span;
-        // 不需要把这个span交给pc管理，pc只能管小于128页的span
+    size_t size = k << PAGE_SHIFT;
+    if (size <= (size_t)(_regionEnd.load(std::memory_order_relaxed) - _regionTop))
+    {
+        void* ptr = _regionTop;
+        SystemCommit(ptr, size);
+        _regionTop += size;
+        return ptr;
+    }
+    // 没有预留到或者预留的地址空间用完了，退回到直接向系统要，这些页由PageMap中的基数树映射
+#endif
+    return SystemAlloc(k);
+}
 
-        return span;
+// 把空闲span挂到对应的链表中
+void PageCache::PushFreeSpan(Span* span)
+{
+    if (!span->_zeroed)
+    {
+        _dirtyBytes += span->_n << PAGE_SHIFT;
     }
 
-    // ① k号桶中有span
-    if (!_spanLists[k].Empty()) 
+    if (span->_n <= PAGE_NUM - 1)
+    {// 不超过128页的按页数挂到桶里
+        _spanLists[span->_n].PushFront(span);
+        return;
+    }
+
+    // 更大的按页数排序，页数相同的按地址从低到高，申请时优先用低地址的
+    _largeSpans.Insert(span);
+}
+
+// 把空闲span从所在的链表中删掉
+void PageCache::EraseFreeSpan(Span* span)
+{
+    if (!span->_zeroed)
     {
-        // 直接返回该桶中的第一个span
-        Span* span = _spanLists[k].PopFront();
+        _dirtyBytes -= span->_n << PAGE_SHIFT;
+    }
 
-        // 记录分配出去的span管理的页号和其地址的映射关系
-        for (PageID i = 0; i < span->_n; ++i) 
+    if (span->_n <= PAGE_NUM - 1)
+    {
+        _spanLists[span->_n].Erase(span);
+    }
+    else
+    {
+        _largeSpans.Erase(span);
+    }
+}
+
+// 找到页数不小于k的最小的空闲span，从链表中取出来，没有返回nullptr
+Span* PageCache::PopFreeSpan(size_t k)
+{
+    for (size_t i = k; i < PAGE_NUM; ++i)
+    {
+        if (!_spanLists[i].Empty())
         {
-            // n页的空间全部映射都是span地址
-            _idSpanMap[span->_pageId + i] = span;
+            Span* span = _spanLists[i].Begin();
+            EraseFreeSpan(span);
+            return span;
         }
+    }
 
-        return span;
+    // _largeSpans是按页数有序的，第一个够大的就是最合适的
+    Span* span = _largeSpans.LowerBound(k);
+    if (span != nullptr)
+    {
+        EraseFreeSpan(span);
     }
 
-    // ② k号桶没有span，但后面的桶中有span
-    for (int i = k + 1; i < PAGE_NUM; ++i) 
-    {// 检查[k+1, PAGE_NUM]中有没有span
+    return span;
+}
 
-        if (!_spanLists[i].Empty())
-        {// i号桶中有span，对该span进行切分
+// pc中拿出来一个k页的span
+Span* PageCache::NewSpan(size_t k)
+{
+    assert(k > 0);
 
-            // 获取到该桶中的span，起名nSpan
-            Span* nSpan = _spanLists[i].PopFront();
+    // 超过128页的先看看缓存中有没有差不多大小的span可以复用
+    if (k > PAGE_NUM - 1)
+    {
+        Span* cached = FetchLargeCache(k);
+        if (cached != nullptr)
+        {
+            _usedBytes += cached->_n << PAGE_SHIFT;
+            return cached;
+        }
+    }
+    else if (!_background && !_largeCache.Empty())
+    {// 程序不再申请释放大块空间时，缓存在小块span的路径上也能超时还给系统
+        TrimLargeCache();
+    }
 
-            // 将这个span切分成一个k页的和一个n-k页的span
+    // ① 在空闲span中找一个最小的够用的，找不到就先把延迟合并的span合并了再找一次
+    Span* span = PopFreeSpan(k);
+    if (span == nullptr && !_deferred.Empty())
+    {
+        FlushDeferred();
+        span = PopFreeSpan(k);
+    }
 
-            // Span的空间是需要新建的，而不是用当前内存池中的空间
-            // Span* kSpan = new Span;
-            Span* kSpan = _spanPool.New();  //用定长内存池开空间
+    // 找到的span不占物理内存或者要向系统申请，交出去之后堆会变大，先检查上限
+    if (span == nullptr || span->_zeroed)
+    {
+        if (HeapBytes() + (k << PAGE_SHIFT) > _hardLimit)
+        {// 先把span放回去，再把空闲页的物理内存都还给系统，空闲span就全都不占物理内存了
+            if (span != nullptr)
+            {
+                CoalesceSpan(span);
+            }
+            ReleaseFreePages(0);
+            if (HeapBytes() + (k << PAGE_SHIFT) > _hardLimit)
+            {
+                throw std::bad_alloc();
+            }
+            span = PopFreeSpan(k);
+        }
+        CheckSoftLimit(k);
+    }
 
-            // 分成一个k页的Span
-            kSpan->_pageId = nSpan->_pageId;
-            kSpan->_n = k;
+    // ② 没有就向系统申请，至少申请128页，多出来的部分切下来留在pc中
+    if (span == nullptr)
+    {
+        size_t n = k > PAGE_NUM - 1 ? k : PAGE_NUM - 1;
+        ALLOC_PROBE(pc_os_map_begin, n);
+        void* ptr = AllocPages(n);
+        ALLOC_PROBE(pc_os_map_end, n, ptr);
+
+        // 系统调用接口申请空间的时候一定能保证申请的空间是对齐的
+        span = _spanPool.New();     // 用定长内存池开空间
+        span->_pageId = ((PageID)ptr) >> PAGE_SHIFT;
+        span->_n = n;
+        span->_zeroed = true;   // 系统新给的页都是0
+    }
 
-            // 和一个 n-k 页的span
-            nSpan->_pageId += k;
-            nSpan->_n -= k;
+    // ③ 比k页大，切分成一个k页的和一个n-k页的span，n-k页的放回pc
+    if (span->_n > k)
+    {
+        ALLOC_PROBE(pc_split, k, span->_n);
+        Span* kSpan = _spanPool.New();
+        kSpan->_pageId = span->_pageId;
+        kSpan->_n = k;
+        kSpan->_zeroed = span->_zeroed;
 
-            // 将n-k页的放回对应的哈希桶中
-            _spanLists[nSpan->_n].PushFront(nSpan);
+        span->_pageId += k;
+        span->_n -= k;
+        PushFreeSpan(span);
 
-            // 再把n-k页的span边缘页映射一下，方便后续合并
-            _idSpanMap[nSpan->_pageId] = nSpan;
-            _idSpanMap[nSpan->_pageId + nSpan->_n - 1] = nSpan; 
+        // 再把n-k页的span边缘页映射一下，方便后续合并
+        _idSpanMap.Set(span->_pageId, span);
+        _idSpanMap.Set(span->_pageId + span->_n - 1, span);
 
-            // 记录分配出去的span管理的页号和其地址的映射关系
-            for (PageID i = 0; i < kSpan->_n; ++i) 
-            {
-                // n页的空间全部映射都是span地址
-                _idSpanMap[kSpan->_pageId + i] = kSpan;
-            }
+        span = kSpan;
+    }
 
-            return kSpan;
+    if (k <= PAGE_NUM - 1)
+    {
+        // 记录分配出去的span管理的页号和其地址的映射关系，n页的空间全部映射都是span地址
+        for (PageID i = 0; i < span->_n; ++i)
+        {
+            _idSpanMap.Set(span->_pageId + i, span);
         }
     }
+    else
+    {
+        // 大块span只会通过首页找到，再映射一下尾页，相邻span合并时就能知道它正在使用
+        _idSpanMap.Set(span->_pageId, span);
+        _idSpanMap.Set(span->_pageId + span->_n - 1, span);
+    }
 
-    // ③ k号桶和后面的桶中都没有span
-
-    // 直接向系统申请128页的span
-    void* ptr = SystemAlloc(PAGE_NUM - 1);  // PAGE_NUM为129
-
-    // 开一个新的span来维护这块空间山南投资
-    // Span* bigSpan = new Span;
-    Span* bigSpan = _spanPool.New();    // 用定长内存池开空间
+    _usedBytes += span->_n << PAGE_SHIFT;
+    return span;
+}
 
-    // 只需要修改_pageId和_n即可，系统调用接口申请空间的时候一定能保证申请的空间是对齐的
-    bigSpan->_pageId = ((PageID)ptr) >> PAGE_SHIFT;
-    bigSpan->_n = PAGE_NUM - 1;
-    
+/* 堆再大k页会超过软上限时，标记一下让申请的慢路径去回收
+   pc中有空闲的物理内存时一定回收，没有的话可能都在用，最多每SOFT_LIMIT_MS毫秒回收一次 */
+void PageCache::CheckSoftLimit(size_t k)
+{
+    if (HeapBytes() + (k << PAGE_SHIFT) <= _softLimit)
+    {
+        return;
+    }
 
-    // 将这个span放到对应的哈希桶中
-    _spanLists[PAGE_NUM - 1].PushFront(bigSpan);
+    size_t now = NowMs();
+    if (_dirtyBytes + _largeCacheBytes > 0 || now - _softLimitMs >= SOFT_LIMIT_MS)
+    {
+        _softLimitMs = now;
+        _softLimitHit.store(true, std::memory_order_relaxed);
+    }
+}
 
-    // 递归再次申请k页的span，这次递归一定会走②的逻辑
-    return NewSpan(k);  // 复用代码
+// 设置堆的软上限和硬上限
+void PageCache::SetLimits(size_t softBytes, size_t hardBytes)
+{
+    assert(softBytes <= hardBytes);
+    _softLimit = softBytes;
+    _hardLimit = hardBytes;
 }
 
 // 通过页地址找到span
@@ -111,72 +247,134 @@ Span* PageCache::MapObjectToSpan(void* obj)
     // 通过块地址找到页号
     PageID id = (((PageID)obj) >> PAGE_SHIFT);
 
-    // 智能锁
-    std::unique_lock<std::mutex> lc(_pageMtx);
-    
-    // 通过哈希表找到页号对应的span
-    auto ret = _idSpanMap.find(id);
+    // 已经分配出去的页的映射不会再被修改，数组和基数树的读都是无锁的，不用加锁
+    Span* ret = _idSpanMap.Get(id);
 
     // 这里的逻辑是一定能保证通过块地址找到一个span，如果没找到就出错了
-    if (ret != _idSpanMap.end())
-    {
-        return ret->second;
-    }
-    else
+    assert(ret != nullptr);
+    return ret;
+}
+
+// 判断ptr是不是内存池中的地址
+bool PageCache::IsOurPointer(void* ptr)
+{
+#if RESERVE_ADDRESS_SPACE
+    // 预留的地址空间中的页比较一下范围就可以，预留空间之外的页只能查映射
+    if ((char*)ptr >= _regionBase.load(std::memory_order_acquire)
+        && (char*)ptr < _regionEnd.load(std::memory_order_acquire))
     {
-        assert(false);
-        return nullptr;
+        return true;
     }
+#endif
+    return _idSpanMap.Get((PageID)ptr >> PAGE_SHIFT) != nullptr;
 }
 
 // 管理cc归还回来的span
 void PageCache::ReleaseSpanToPageCache(Span* span)
 {
-    // 通过span判断释放的看空间页数是否大于128页，如果大于128页就直接还给os
+    span->_zeroed = false;  // 用过的span里面什么都有可能
+    _usedBytes -= span->_n << PAGE_SHIFT;
+
+    // 通过span判断释放的看空间页数是否大于128页，如果大于128页就先放进缓存，缓存满了或者超时再还给os
     if (span->_n > PAGE_NUM - 1)
     {
-        void* ptr = (void*)(span->_pageId << PAGE_SHIFT);   // 计算释放的地址
         size_t size = span->_n << PAGE_SHIFT;       // 计算释放空间大小：页数 * 每页大小
-        SystemFree(ptr, size);
-        // delete span;    // 释放span管理对象
-        _spanPool.Delete(span); // 用定长内存池删除span
+        if (size > LARGE_CACHE_BYTES || OverSoftLimit())
+        {// 比整个缓存还大或者堆超过了软上限，直接还给os
+            FreeLargeSpan(span);
+            return;
+        }
+
+        // 缓存中的span不能被pc合并，_isUse保持为true
+        span->_isUse = true;
+        span->_freeTime = NowMs();
+        _largeCache.PushFront(span);
+        _largeCacheBytes += size;
 
+        // 后台模式下只有超过字节上限时才当场淘汰
+        if (!_background || _largeCacheBytes > LARGE_CACHE_BYTES)
+        {
+            TrimLargeCache();
+        }
         return;
     }
 
-    // 释放空间页数小于128页
-    // 向左不断合并
-    while (true)
+    if (!_background && !_largeCache.Empty())
+    {// 和NewSpan一样，顺便把超时的大块span还给系统
+        TrimLargeCache();
+    }
+
+    if (_background)
+    {// 先挂起来，_isUse保持为true，相邻span合并时不会碰它
+        span->_isUse = true;
+        _deferred.PushFront(span);
+        _dirtyBytes += span->_n << PAGE_SHIFT;  // 还没合并也是还占着物理内存的空闲空间
+        return;
+    }
+
+    // 不超过128页的span每一页都映射过，空闲span只保留首尾页的映射，中间的删掉
+    for (PageID i = 1; i + 1 < span->_n; ++i)
     {
-        PageID leftID = span->_pageId - 1;  // 拿到左边相邻页
-        auto ret = _idSpanMap.find(leftID); // 通过相邻页映射出对应的span
+        _idSpanMap.Erase(span->_pageId + i);
+    }
 
-        // 没有相邻span，停止合并
-        if (ret == _idSpanMap.end())
-        {
-            break;
-        }
+    CoalesceSpan(span);
+    CheckSoftLimit(0);  // 超过软上限时让申请的慢路径把合并出来的空闲页还给系统
+}
 
-        // 相邻span在cc中，停止合并
-        Span* leftSpan = ret->second;   // 相邻span
-        if (leftSpan->_isUse)
+// 打开/关闭后台模式
+void PageCache::SetBackground(bool on)
+{
+    _background = on;
+    if (!on)
+    {
+        FlushDeferred();
+    }
+}
+
+// 把延迟合并的span全部合并掉
+void PageCache::FlushDeferred()
+{
+    while (!_deferred.Empty())
+    {
+        Span* span = _deferred.PopFront();
+        _dirtyBytes -= span->_n << PAGE_SHIFT;  // 合并之后挂回pc时再重新算
+        for (PageID i = 1; i + 1 < span->_n; ++i)
         {
-            break;
+            _idSpanMap.Erase(span->_pageId + i);
         }
+        CoalesceSpan(span);
+    }
+}
 
-        // 相邻span与当前span合并后超过128页，停止合并
-        if (leftSpan->_n + span->_n > PAGE_NUM - 1) 
+// 和左右相邻的空闲span合并成一个，合并多少页都可以，最后挂回pc
+void PageCache::CoalesceSpan(Span* span)
+{
+    size_t oldPages = span->_n;
+
+    // 向左不断合并
+    while (true)
+    {
+        PageID leftID = span->_pageId - 1;  // 拿到左边相邻页
+        Span* leftSpan = _idSpanMap.Get(leftID); // 通过相邻页映射出对应的span
+
+        // 没有相邻span或者相邻span正在使用，停止合并
+        if (leftSpan == nullptr || leftSpan->_isUse)
         {
             break;
         }
 
-        // 相邻span与当前span合并
+        // 两个span接上的地方变成了中间页，映射删掉，不然会指向被删除的span
+        _idSpanMap.Erase(leftID);
+        _idSpanMap.Erase(span->_pageId);
+
+        // 相邻span与当前span合并，两边都是0合并之后才是0
         span->_pageId = leftSpan->_pageId;
         span->_n += leftSpan->_n;
+        span->_zeroed = span->_zeroed && leftSpan->_zeroed;
 
-        // 将相邻span对象从桶中删除
-        _spanLists[leftSpan->_n].Erase(leftSpan);
-        // delete leftSpan;  
+        // 将相邻span对象从链表中删除
+        EraseFreeSpan(leftSpan);
         _spanPool.Delete(leftSpan); // 用定长内存池删除span
     }
 
@@ -184,42 +382,158 @@ void PageCache::ReleaseSpanToPageCache(Span* span)
     while (true)
     {
         PageID rightID = span->_pageId + span->_n;
-        auto ret = _idSpanMap.find(rightID);
+        Span* rightSpan = _idSpanMap.Get(rightID);
 
-        // 没有相邻span，停止合并
-        if (ret == _idSpanMap.end())
+        if (rightSpan == nullptr || rightSpan->_isUse)
         {
             break;
         }
 
-        // 相邻span在cc中，停止合并
-        Span* rightSpan = ret->second;
-        if (rightSpan->_isUse)
+        _idSpanMap.Erase(rightID);
+        _idSpanMap.Erase(rightID - 1);
+
+        // 往右边合并时不需要修改span->_pageId，右边的会直接拼在span后面
+        span->_n += rightSpan->_n;
+        span->_zeroed = span->_zeroed && rightSpan->_zeroed;
+
+        EraseFreeSpan(rightSpan);
+        _spanPool.Delete(rightSpan);
+    }
+
+    // 合并完毕，将当前span挂到对应链表中
+    PushFreeSpan(span);
+    span->_isUse = false;   // 回到pc，isUse改成false
+
+    // 映射当前span的边缘页，后续还可以对这个span合并
+    _idSpanMap.Set(span->_pageId, span);
+    _idSpanMap.Set(span->_pageId + span->_n - 1, span);
+
+    ALLOC_PROBE(pc_coalesce, span->_pageId, oldPages, span->_n);
+}
+
+// 把空闲页的物理内存还给系统
+size_t PageCache::ReleaseFreePages(size_t keepBytes)
+{
+    FlushDeferred();
+
+    // 先淘汰大块缓存，淘汰掉的span物理内存直接还给系统
+    size_t released = _largeCacheBytes;
+    TrimLargeCache(keepBytes);
+    released -= _largeCacheBytes;
+    size_t keep = keepBytes > _largeCacheBytes ? keepBytes - _largeCacheBytes : 0;
+
+    // _zeroed为true的span要么刚从系统拿来还没碰过，要么已经还过了，不占物理内存
+    size_t dirty = _dirtyBytes;
+
+    // 从大的span开始还，系统调用次数少
+    auto release = [&](Span* span) {
+        if (!span->_zeroed)
         {
-            break;
+            size_t bytes = span->_n << PAGE_SHIFT;
+            span->_zeroed = SystemDecommit((void*)(span->_pageId << PAGE_SHIFT), bytes);
+            if (span->_zeroed)
+            {
+                _dirtyBytes -= bytes;
+            }
+            dirty -= bytes;
+            released += bytes;
+        }
+    };
+    _largeSpans.ForEachDescending([&](Span* span) {
+        if (dirty <= keep)
+        {
+            return false;
+        }
+        release(span);
+        return true;
+    });
+    for (size_t i = PAGE_NUM - 1; i > 0 && dirty > keep; --i)
+    {
+        for (Span* it = _spanLists[i].Begin(); it != _spanLists[i].End() && dirty > keep; it = it->_next)
+        {
+            release(it);
         }
+    }
+
+    return released;
+}
+
+// pc中最大的一段连续空闲空间有多少页
+size_t PageCache::LargestFreeRun()
+{
+    std::unique_lock<PageMutex> lc(_pageMtx);
+    FlushDeferred();
 
-        // 相邻span与当前span合并后超过128页，停止合并
-        if (rightSpan->_n + span->_n > PAGE_NUM - 1)
+    // _largeSpans是按页数有序的，最后一个最大
+    if (!_largeSpans.Empty())
+    {
+        return _largeSpans.Max()->_n;
+    }
+
+    for (size_t i = PAGE_NUM - 1; i > 0; --i)
+    {
+        if (!_spanLists[i].Empty())
         {
-            break;
+            return i;
         }
+    }
 
-        // 相邻span与当前span合并，往右边合并时不需要修改span->_pageId，右边的会直接拼在span后面
-        span->_n += rightSpan->_n;
+    return 0;
+}
 
-        // 把桶里的span删掉
-        _spanLists[rightSpan->_n].Erase(rightSpan);
-        // delete rightSpan
-        _spanPool.Delete(rightSpan);    // 用定长内存池删除span
+// 从缓存中找一个页数在[k, k + k/4]之间且最小的span
+Span* PageCache::FetchLargeCache(size_t k)
+{
+    if (!_background)
+    {
+        TrimLargeCache();   // 顺便把超时的span还给系统，后台模式下由后台线程来做
     }
 
-    // 合并完毕，将当前span挂到对应桶中
-    _spanLists[span->_n].PushFront(span);
-    span->_isUse = false;   // 从cc返回pc，isUse改成false
+    Span* best = nullptr;
+    for (Span* it = _largeCache.Begin(); it != _largeCache.End(); it = it->_next)
+    {
+        if (it->_n >= k && it->_n <= k + k / 4 && (best == nullptr || it->_n < best->_n))
+        {
+            best = it;
+        }
+    }
 
-    // 映射当前span的边缘页，后续还可以对这个span合并
-    _idSpanMap[span->_pageId] = span;
-    _idSpanMap[span->_pageId + span->_n - 1] = span;
+    if (best != nullptr)
+    {
+        _largeCache.Erase(best);
+        _largeCacheBytes -= best->_n << PAGE_SHIFT;
+    }
+
+    return best;
+}
+
+// 把缓存中空闲超时的大块span还给系统
+void PageCache::TrimLargeCache(size_t keepBytes)
+{
+    size_t now = NowMs();
 
-}
\ No newline at end of file
+    // 最老的在链表尾部，从后往前淘汰，直到不超过字节上限并且没有超时的span
+    while (!_largeCache.Empty())
+    {
+        Span* oldest = _largeCache.End()->_prev;
+        if (_largeCacheBytes <= keepBytes && now - oldest->_freeTime < LARGE_CACHE_IDLE_MS)
+        {
+            break;
+        }
+
+        _largeCache.Erase(oldest);
+        _largeCacheBytes -= oldest->_n << PAGE_SHIFT;
+        FreeLargeSpan(oldest);
+    }
+}
+
+// 把大块span的物理内存还给系统，地址空间留在pc中和相邻的空闲span合并
+void PageCache::FreeLargeSpan(Span* span)
+{
+    void* ptr = (void*)(span->_pageId << PAGE_SHIFT);   // 计算释放的地址
+    size_t size = span->_n << PAGE_SHIFT;       // 计算释放空间大小：页数 * 每页大小
+    span->_zeroed = SystemDecommit(ptr, size);
+
+    // 大块span本来就只映射了首尾页，直接合并
+    CoalesceSpan(span);
+}
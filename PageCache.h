@@ -1,5 +1,6 @@
 #pragma once
 #include "Common.h"
+#include "PageMap.h"
 
 class PageCache
 {
@@ -18,20 +19,121 @@ public:
 
     // 管理cc归还回来的span
     void ReleaseSpanToPageCache(Span* span);
+
+    // 把缓存中空闲超时的大块span还给系统，keepBytes表示缓存最多留下多少字节
+    void TrimLargeCache(size_t keepBytes = LARGE_CACHE_BYTES);
+
+    // 判断ptr是不是内存池中的地址
+    bool IsOurPointer(void* ptr);
+
+    // pc中最大的一段连续空闲空间有多少页
+    size_t LargestFreeRun();
+
+    /* 打开后台模式之后，释放span时不再当场合并，大块缓存也不再当场淘汰，
+       都交给后台线程调用FlushDeferred和TrimLargeCache来做，调用时要持有_pageMtx */
+    void SetBackground(bool on);
+
+    // 把延迟合并的span全部合并掉
+    void FlushDeferred();
+
+    /* 把空闲页的物理内存还给系统，直到大块缓存和还占着物理内存的空闲span加起来不超过keepBytes
+       返回还了多少字节，调用时要持有_pageMtx */
+    size_t ReleaseFreePages(size_t keepBytes);
+
+    /* 设置堆的软上限和硬上限，单位字节，默认都没有上限，调用时要持有_pageMtx
+       超过软上限之后，申请的慢路径上会把线程缓存、cc中没用过的span和pc中空闲页的物理内存还回去
+       要用新的物理内存并且会超过硬上限时，先把pc中空闲页的物理内存还给系统，还是不够就抛出std::bad_alloc */
+    void SetLimits(size_t softBytes, size_t hardBytes);
+
+    /* 堆的大小：分配出去的span、大块缓存和还占着物理内存的空闲span的字节数之和，调用时要持有_pageMtx
+       空闲span合并时只要有一边占着物理内存，整个都按占着算，所以是偏大的估计，把空闲页还给系统之后就准了 */
+    size_t HeapBytes() const
+    {
+        return _usedBytes + _largeCacheBytes + _dirtyBytes;
+    }
+
+    // 堆的大小是不是超过了软上限，调用时要持有_pageMtx
+    bool OverSoftLimit() const
+    {
+        return HeapBytes() > _softLimit;
+    }
+
+    // 堆是不是超过了软上限需要回收，读完标记就清掉，同一次超过只让一个线程去回收
+    bool TakeSoftLimitHit()
+    {
+        return _softLimitHit.load(std::memory_order_relaxed)
+            && _softLimitHit.exchange(false, std::memory_order_relaxed);
+    }
 public:
-    std::mutex _pageMtx;    // pc全局的锁
+    PageMutex _pageMtx;    // pc全局的锁
     
 private:
-    SpanList _spanLists[PAGE_NUM];  // pc中的哈希表
+    SpanList _spanLists[PAGE_NUM];  // pc中的哈希表，不超过128页的空闲span按页数挂在这里
+
+    // 超过128页的空闲span按(页数, 页号)排序
+    SpanTree _largeSpans;
 
-    // 哈希映射，用来快速通过页号找到对应span
-    std::unordered_map<PageID, Span*> _idSpanMap;
+    bool _background = false;   // 是否打开了后台模式
+    SpanList _deferred;         // 后台模式下还回来但还没合并的span
+
+    // 页号到span的映射，预留地址空间时是数组，否则是哈希表
+    PageMap _idSpanMap;
 
     // 创建span的对象池
     ObjectPool<Span> _spanPool;
 
-    // 私有化构造函数
-    PageCache() {}
+    /* 释放掉的超过128页的大块span先缓存起来，下次申请差不多大小的时候直接复用，
+       不用每次都mmap/munmap，最新释放的在前面
+       超时是在pc的NewSpan/ReleaseSpanToPageCache里顺便检查的，后台模式下由后台线程检查，
+       所以程序完全不再向pc申请释放span时(比如所有线程都只用tc中的块)，缓存会一直留着，
+       这时可以调用ConcurrentTrim主动还回去 */
+    SpanList _largeCache;
+    size_t _largeCacheBytes = 0;    // 缓存中span的总字节数
+
+    size_t _usedBytes = 0;      // 分配出去还没还回来的span的总字节数
+    size_t _dirtyBytes = 0;     // 空闲span中_zeroed为false，也就是还占着物理内存的总字节数
+    size_t _softLimit = (size_t)-1;
+    size_t _hardLimit = (size_t)-1;
+    size_t _softLimitMs = 0;    // 上一次超过软上限的时间(ms)
+    std::atomic<bool> _softLimitHit{ false };
+
+    // 堆要变大k页时检查软上限
+    void CheckSoftLimit(size_t k);
+
+    // 从缓存中找一个页数在[k, k + k/4]之间且最小的span，没有返回nullptr
+    Span* FetchLargeCache(size_t k);
+
+    // 把大块span的物理内存还给系统
+    void FreeLargeSpan(Span* span);
+
+    // 把空闲span挂到对应的链表中/从链表中删掉
+    void PushFreeSpan(Span* span);
+    void EraseFreeSpan(Span* span);
+
+    // 取出页数不小于k的最小空闲span
+    Span* PopFreeSpan(size_t k);
+
+    // 和左右相邻的空闲span合并后挂回pc
+    void CoalesceSpan(Span* span);
+
+    // 向系统要k页的空间
+    void* AllocPages(size_t k);
+
+#if RESERVE_ADDRESS_SPACE
+    /* 预留的地址空间[_regionBase, _regionEnd)，第一次向系统要页的时候才预留
+       IsOurPointer不加锁读，所以是atomic的 */
+    std::atomic<char*> _regionBase{ nullptr };
+    std::atomic<char*> _regionEnd{ nullptr };
+    char* _regionTop = nullptr;     // 还没用过的空间从这里开始
+    bool _reserved = false;         // 是不是已经预留过了，不管成功没有
+
+    // 预留地址空间，预留不到RESERVE_BYTES就减半再试，调用时要持有_pageMtx
+    void Reserve();
+#endif
+
+    /* 私有化构造函数，constexpr的构造函数让_sInst在编译期就初始化好，
+       main之前和静态初始化期间调用内存池也是安全的 */
+    constexpr PageCache() {}
 
     // 删除拷贝构造函数和赋值运算符重载函数
     PageCache(const PageCache& pc) = delete;
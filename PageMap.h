@@ -0,0 +1,129 @@
+#pragma once
+#include "Common.h"
+
+/* 页可能分布在整个地址空间中时用两层的基数树
+   页号的高ROOT_BITS位是第一层的下标，低LEAF_BITS位是叶子中的下标
+   第一层是静态的数组，叶子用到的时候才向系统申请，不依赖malloc，读是无锁的，写只在pc的锁内进行 */
+class RadixPageMap
+{
+public:
+    constexpr RadixPageMap() {}
+
+    Span* Get(PageID id) const
+    {
+        if ((id >> LEAF_BITS) >= ROOT_NUM)
+        {
+            return nullptr;
+        }
+
+        Leaf* leaf = _root[id >> LEAF_BITS].load(std::memory_order_acquire);
+        return leaf != nullptr ? leaf->_spans[id & (LEAF_NUM - 1)].load(std::memory_order_relaxed) : nullptr;
+    }
+
+    void Set(PageID id, Span* span)
+    {
+        assert((id >> LEAF_BITS) < ROOT_NUM);
+
+        std::atomic<Leaf*>& slot = _root[id >> LEAF_BITS];
+        Leaf* leaf = slot.load(std::memory_order_relaxed);
+        if (leaf == nullptr)
+        {// mmap出来的叶子全是0，也就是全部映射为nullptr
+            leaf = (Leaf*)SystemAlloc(SizeClass::_RoundUp(sizeof(Leaf), 1 << PAGE_SHIFT) >> PAGE_SHIFT);
+            slot.store(leaf, std::memory_order_release);
+        }
+        leaf->_spans[id & (LEAF_NUM - 1)].store(span, std::memory_order_relaxed);
+    }
+
+    void Erase(PageID id)
+    {
+        if (Get(id) != nullptr)
+        {// 没有叶子的页本来就查不到，不用为了删除去申请叶子
+            Set(id, nullptr);
+        }
+    }
+
+private:
+    // 64位下用户态地址不超过48位，32位下是32位
+    static const size_t ADDRESS_BITS = sizeof(void*) == 8 ? 48 : 32;
+    static const size_t PAGE_ID_BITS = ADDRESS_BITS - PAGE_SHIFT;
+    static const size_t ROOT_BITS = PAGE_ID_BITS / 2;
+    static const size_t LEAF_BITS = PAGE_ID_BITS - ROOT_BITS;
+    static const size_t ROOT_NUM = (size_t)1 << ROOT_BITS;
+    static const size_t LEAF_NUM = (size_t)1 << LEAF_BITS;
+
+    struct Leaf
+    {
+        std::atomic<Span*> _spans[LEAF_NUM];
+    };
+
+    // 64位下第一层是1MB，放在静态存储区，没用到的部分不会占物理内存
+    std::atomic<Leaf*> _root[ROOT_NUM] = {};
+};
+
+#if RESERVE_ADDRESS_SPACE
+
+/* 页号到span的映射：预留的连续地址空间中的页直接用(页号 - 起始页号)做数组下标
+   数组本身也是按需分配物理内存的，读是无锁的，写只在pc的锁内进行
+   数组在pc第一次预留地址空间的时候才分配，预留失败或者预留的空间用完之后向系统要的页不在数组的范围内，
+   放到基数树里，只有这些页的查找才会多走一步 */
+class PageMap
+{
+public:
+    constexpr PageMap() {}
+
+    // 管理从basePage开始的pageNum页
+    void Init(PageID basePage, size_t pageNum)
+    {
+        size_t bytes = SizeClass::_RoundUp(pageNum * sizeof(std::atomic<Span*>), 1 << PAGE_SHIFT);
+
+        // mmap出来的空间全是0，也就是全部映射为nullptr
+        _spans = (std::atomic<Span*>*)SystemAlloc(bytes >> PAGE_SHIFT);
+        _basePage = basePage;
+        _pageNum = pageNum;
+    }
+
+    Span* Get(PageID id) const
+    {
+        size_t i = id - _basePage;  // id比_basePage小时会变成很大的数，同样不在范围内
+        return i < _pageNum ? _spans[i].load(std::memory_order_relaxed) : _overflow.Get(id);
+    }
+
+    void Set(PageID id, Span* span)
+    {
+        size_t i = id - _basePage;
+        if (i < _pageNum)
+        {
+            _spans[i].store(span, std::memory_order_relaxed);
+        }
+        else
+        {
+            _overflow.Set(id, span);
+        }
+    }
+
+    void Erase(PageID id)
+    {
+        size_t i = id - _basePage;
+        if (i < _pageNum)
+        {
+            _spans[i].store(nullptr, std::memory_order_relaxed);
+        }
+        else
+        {
+            _overflow.Erase(id);
+        }
+    }
+
+private:
+    std::atomic<Span*>* _spans = nullptr;
+    PageID _basePage = 0;
+    size_t _pageNum = 0;
+    RadixPageMap _overflow;     // 不在预留空间中的页
+};
+
+#else
+
+// 没有预留地址空间时，所有页都用基数树映射
+typedef RadixPageMap PageMap;
+
+#endif
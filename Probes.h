@@ -0,0 +1,42 @@
+#pragma once
+
+/* USDT静态探针，给perf/bpftrace在线上排查用，只放在慢路径上，tc的快路径上一个都没有
+   探针在代码里只是一条nop，参数的位置记在ELF的note里，没有工具挂上来时几乎没有开销
+   需要计时的事件都是_begin/_end成对的，外面的工具按线程把两次触发的时间相减就能画出延迟分布
+   能找到<sys/sdt.h>(systemtap-sdt-dev)时默认打开，-DALLOC_PROBES=0 可以去掉所有探针，参数也不会求值
+
+   provider都是cmpool，探针和参数：
+   tc_refill_begin(index, size, batchNum)   tc的桶空了去cc取块
+   tc_refill_end(index, size, actualNum)
+   tc_flush_begin(index, size, n)           tc的桶到了高水位，把n块还给cc
+   tc_flush_end(index, size, n)
+   cc_span_begin(index, size, pages)        cc向pc要一个全新的span切成size大小的块
+   cc_span_end(index, size, pages)
+   pc_split(k, n)                           pc把一个n页的空闲span切出k页
+   pc_os_map_begin(pages)                   pc向系统要pages页
+   pc_os_map_end(pages, ptr)
+   pc_coalesce(pageId, oldPages, newPages)  还回pc的span和相邻的空闲span合并，oldPages == newPages表示没有合并
+   large_alloc_begin(size)                  超过256KB的申请
+   large_alloc_end(size, ptr, pages)
+   large_free(ptr, bytes)                   超过256KB的释放
+   bpftrace的例子在tools/bpftrace中
+*/
+
+#ifndef ALLOC_PROBES
+    #if defined(__has_include)
+        #if __has_include(<sys/sdt.h>)
+            #define ALLOC_PROBES 1
+        #endif
+    #endif
+#endif
+#ifndef ALLOC_PROBES
+    #define ALLOC_PROBES 0
+#endif
+
+#if ALLOC_PROBES
+    #include <sys/sdt.h>
+    #define ALLOC_PROBE(name, ...) STAP_PROBEV(cmpool, name, __VA_ARGS__)
+#else
+    // 参数放在sizeof里不会求值，只给探针用的变量也不会报没有用过的警告
+    #define ALLOC_PROBE(name, ...) ((void)sizeof((__VA_ARGS__, 0)))
+#endif
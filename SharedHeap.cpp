@@ -0,0 +1,524 @@
+#include "SharedHeap.h"
+
+#ifndef _WIN32
+
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// 修改元数据期间把_busy置1，进程在这期间崩溃的话，下次打开时能发现
+class SharedHeapBusy
+{
+public:
+    explicit SharedHeapBusy(SharedHeapHeader* header)
+        : _header(header)
+    {
+        _header->_busy.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);    // 之后对元数据的修改不能提到前面来
+    }
+
+    ~SharedHeapBusy()
+    {
+        _header->_busy.store(0, std::memory_order_release);    // 之前对元数据的修改不能挪到后面去
+    }
+
+private:
+    SharedHeapHeader* _header;
+};
+
+// 在作用域内持有区域的锁
+class SharedHeapLock
+{
+public:
+    explicit SharedHeapLock(SharedHeap* heap)
+        : _heap(heap)
+    {
+        _heap->Lock();
+    }
+
+    ~SharedHeapLock()
+    {
+        _heap->Unlock();
+    }
+
+private:
+    SharedHeap* _heap;
+};
+
+// 把mtx初始化成进程间共享的健壮锁
+static void InitSharedMutex(pthread_mutex_t* mtx)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifndef __APPLE__
+    // macOS没有健壮锁，持有者死掉之后其他进程还是会一直等
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+    pthread_mutex_init(mtx, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/* 进程随时可能被杀掉，元数据要按固定的顺序写：先写好新的内容，再把它挂到能被找到的地方，
+   只挡住编译器重排就够了，被杀掉的进程已经执行过的写都会留在共享的页中 */
+static inline void SharedHeapOrder()
+{
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+// 映射fd对应的区域
+SharedHeap::SharedHeap(int fd, size_t bytes, bool format, void* base)
+    : _fd(fd)
+{
+    if (bytes == 0)
+    {// 区域已经建好了，大小就是文件的大小
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            throw std::bad_alloc();
+        }
+        bytes = (size_t)st.st_size;
+    }
+    _bytes = bytes;
+
+    if (base != nullptr)
+    {// 持久化分配域必须映射到固定的地址，不能覆盖已有的映射
+        assert(((size_t)base & ((1 << PAGE_SHIFT) - 1)) == 0);
+#ifdef MAP_FIXED_NOREPLACE
+        void* ptr = mmap(base, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+#else
+        void* ptr = mmap(base, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+#endif
+        if (ptr != base)
+        {
+            if (ptr != MAP_FAILED)
+            {
+                munmap(ptr, bytes);
+            }
+            throw std::bad_alloc();
+        }
+        _base = (char*)ptr;
+    }
+    else
+    {
+        // 先预留按8KB对齐的地址空间，再把共享内存映射上去，区域内的页和内存池其他地方一样按8KB对齐
+        void* reserved = SystemReserve(bytes);
+        if (reserved == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        void* ptr = mmap(reserved, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+        if (ptr == MAP_FAILED)
+        {
+            SystemFree(reserved, bytes);
+            throw std::bad_alloc();
+        }
+        _base = (char*)ptr;
+    }
+
+    if (format)
+    {
+        try
+        {
+            Format();
+        }
+        catch (const std::bad_alloc&)
+        {// 析构函数不会执行，映射要在这里解除，固定地址的映射不解除的话这个地址之后再也用不了
+            SystemFree(_base, _bytes);
+            throw;
+        }
+    }
+}
+
+SharedHeap::~SharedHeap()
+{
+    // 只是当前进程不再映射，区域中的对象还在，其他进程可以继续用
+    SystemFree(_base, _bytes);
+    if (_fd >= 0)
+    {
+        close(_fd);
+    }
+}
+
+// 区域是不是已经建好的分配域
+bool SharedHeap::Valid() const
+{
+    return _bytes >= sizeof(SharedHeapHeader)
+        && Header()->_magic == SHARED_HEAP_MAGIC && Header()->_bytes == _bytes;
+}
+
+// bytes字节的区域能不能建成分配域
+bool SharedHeap::Formattable(size_t bytes)
+{
+    size_t pageNum = bytes >> PAGE_SHIFT;
+    size_t tableOffset = SizeClass::_RoundUp(sizeof(SharedHeapHeader), 64);
+    size_t metaPages = SizeClass::_RoundUp(tableOffset + pageNum * sizeof(SharedPage), 1 << PAGE_SHIFT) >> PAGE_SHIFT;
+
+    // 页号用32位存，区域也至少要有一页数据页
+    return pageNum <= UINT32_MAX && metaPages < pageNum;
+}
+
+// 在区域中建好空的分配域，新的共享内存全是0
+void SharedHeap::Format()
+{
+    if (!Formattable(_bytes))
+    {
+        throw std::bad_alloc();
+    }
+
+    size_t pageNum = _bytes >> PAGE_SHIFT;
+    size_t tableOffset = SizeClass::_RoundUp(sizeof(SharedHeapHeader), 64);
+    size_t metaPages = SizeClass::_RoundUp(tableOffset + pageNum * sizeof(SharedPage), 1 << PAGE_SHIFT) >> PAGE_SHIFT;
+
+    SharedHeapHeader* header = Header();
+    header->_bytes = _bytes;
+    header->_pageNum = pageNum;
+    header->_tableOffset = tableOffset;
+    header->_baseAddress = (size_t)_base;
+    header->_root = 0;
+    header->_usedBytes = 0;
+    header->_pending = 0;
+    InitSharedMutex(&header->_mtx);
+
+    // 页表全是0，也就是全部是SHARED_PAGE_META，数据页整个作为一个空闲段
+    FreeRun(metaPages, pageNum - metaPages);
+
+    // 最后写magic，其他进程看到magic时分配域一定是建好的
+    header->_magic = SHARED_HEAP_MAGIC;
+}
+
+// 空闲段按页数挂在哪个链表中
+static inline size_t RunList(size_t n)
+{
+    return n < PAGE_NUM ? n : PAGE_NUM;
+}
+
+// 把空闲段挂到对应的链表中
+void SharedHeap::PushRun(size_t first)
+{
+    SharedPage& page = Page(first);
+    uint32_t& head = Header()->_runLists[RunList(page._n)];
+
+    page._prev = 0;
+    page._next = head;
+    if (head != 0)
+    {
+        Page(head)._prev = (uint32_t)first;
+    }
+    head = (uint32_t)first;
+}
+
+// 把空闲段从链表中删掉
+void SharedHeap::EraseRun(size_t first)
+{
+    SharedPage& page = Page(first);
+    if (page._prev != 0)
+    {
+        Page(page._prev)._next = page._next;
+    }
+    else
+    {
+        Header()->_runLists[RunList(page._n)] = page._next;
+    }
+
+    if (page._next != 0)
+    {
+        Page(page._next)._prev = page._prev;
+    }
+}
+
+// 把从first开始的n页标记成一个空闲段，和左右相邻的空闲段合并
+void SharedHeap::FreeRun(size_t first, size_t n)
+{
+    // 左边相邻页是左边那一段的尾页
+    SharedPage& left = Page(first - 1);
+    if (left._state == SHARED_PAGE_FREE)
+    {
+        size_t leftFirst = first - left._n;
+        EraseRun(leftFirst);
+        first = leftFirst;
+        n += Page(leftFirst)._n;
+    }
+
+    // 右边相邻页是右边那一段的首页
+    size_t right = first + n;
+    if (right < Header()->_pageNum && Page(right)._state == SHARED_PAGE_FREE)
+    {
+        EraseRun(right);
+        n += Page(right)._n;
+    }
+
+    // 首尾页记下段的页数，相邻段释放时才能找到这一段
+    SharedPage& head = Page(first);
+    SharedPage& tail = Page(first + n - 1);
+    head._n = tail._n = (uint32_t)n;
+    head._state = tail._state = SHARED_PAGE_FREE;
+
+    PushRun(first);
+}
+
+// 取出一个k页的段并标记成state
+size_t SharedHeap::AllocRun(size_t k, SharedPageState state)
+{
+    // 页数小于PAGE_NUM的链表中每个段都一样大，第一个就够；最后一个链表要找一个够大的
+    size_t first = 0;
+    for (size_t i = RunList(k); i < SHARED_RUN_LIST_NUM && first == 0; ++i)
+    {
+        for (uint32_t id = Header()->_runLists[i]; id != 0; id = Page(id)._next)
+        {
+            if (Page(id)._n >= k)
+            {
+                first = id;
+                break;
+            }
+        }
+    }
+
+    if (first == 0)
+    {// 区域的大小是固定的，用完了就是用完了
+        throw std::bad_alloc();
+    }
+
+    EraseRun(first);
+    size_t n = Page(first)._n;
+
+    // 比k页大，后面的n-k页作为新的空闲段挂回去，两边都不是空闲的，不会再合并
+    if (n > k)
+    {
+        SharedPage& head = Page(first + k);
+        SharedPage& tail = Page(first + n - 1);
+        head._n = tail._n = (uint32_t)(n - k);
+        head._state = tail._state = SHARED_PAGE_FREE;
+        PushRun(first + k);
+        SharedHeapOrder();  // 后面的段写好了再缩小这一段，恢复时按首页走不会走到没写过的页
+    }
+
+    // 先记下这一段再标记成使用中，交出去之前崩溃的话修复时能找到它
+    Header()->_pending = first;
+    SharedHeapOrder();
+
+    SharedPage& head = Page(first);
+    SharedPage& tail = Page(first + k - 1);
+    head._n = tail._n = (uint32_t)k;
+    head._state = tail._state = state;
+
+    Header()->_usedBytes += k << PAGE_SHIFT;
+    return first;
+}
+
+// 申请size大小的空间
+void* SharedHeap::Allocate(size_t size)
+{
+    SharedHeapLock lock(this);
+    SharedHeapBusy busy(Header());
+
+    if (size > MAX_BYTES)
+    {// 大块空间单独占一段
+        size_t first = AllocRun(SizeClass::RoundUp(size) >> PAGE_SHIFT, SHARED_PAGE_LARGE);
+        SharedHeapOrder();
+        Header()->_pending = 0;
+        return _base + (first << PAGE_SHIFT);
+    }
+
+    size_t alignSize = SizeClass::RoundUp(size);
+    size_t index = SizeClass::Index(size);
+    size_t& freeList = Header()->_freeLists[index];
+
+    if (freeList == 0)
+    {// 桶空了，切一段新的页，每一页都记下桶号，释放时通过页号就能找到桶
+        size_t k = SizeClass::NumMovePage(alignSize);
+        size_t first = AllocRun(k, SHARED_PAGE_SMALL);
+        for (size_t i = 0; i < k; ++i)
+        {
+            Page(first + i)._state = SHARED_PAGE_SMALL;
+            Page(first + i)._index = (uint16_t)index;
+        }
+
+        // 只切完整的块，块之间用偏移量串起来
+        size_t start = first << PAGE_SHIFT;
+        size_t num = (k << PAGE_SHIFT) / alignSize;
+        for (size_t i = 0; i + 1 < num; ++i)
+        {
+            BlockNext(start + i * alignSize) = start + (i + 1) * alignSize;
+        }
+        BlockNext(start + (num - 1) * alignSize) = 0;
+        SharedHeapOrder();
+        freeList = start;
+        SharedHeapOrder();
+        Header()->_pending = 0;     // 挂到桶上了，修复时通过桶就能找到
+    }
+
+    size_t offset = freeList;
+    freeList = BlockNext(offset);
+    return _base + offset;
+}
+
+// 释放obj
+void SharedHeap::Deallocate(void* obj)
+{
+    assert(obj);
+    size_t offset = ToOffset(obj);
+
+    SharedHeapLock lock(this);
+    SharedHeapBusy busy(Header());
+
+    SharedPage& page = Page(offset >> PAGE_SHIFT);
+    if (page._state == SHARED_PAGE_SMALL)
+    {// 小块空间挂回桶中，页不还回去，和Heap一样
+        size_t& freeList = Header()->_freeLists[page._index];
+        BlockNext(offset) = freeList;
+        SharedHeapOrder();
+        freeList = offset;
+    }
+    else
+    {// 大块空间一定是段的首地址
+        assert(page._state == SHARED_PAGE_LARGE && (offset & ((1 << PAGE_SHIFT) - 1)) == 0);
+        size_t n = page._n;
+        Header()->_usedBytes -= n << PAGE_SHIFT;
+        FreeRun(offset >> PAGE_SHIFT, n);
+    }
+}
+
+// 分配出去的页的字节数
+size_t SharedHeap::UsedBytes()
+{
+    SharedHeapLock lock(this);
+    return Header()->_usedBytes;
+}
+
+// 设置根对象
+void SharedHeap::SetRoot(void* root)
+{
+    SharedHeapLock lock(this);
+    Header()->_root = root != nullptr ? ToOffset(root) : 0;
+}
+
+void* SharedHeap::Root()
+{
+    SharedHeapLock lock(this);
+    return Header()->_root != 0 ? ToPointer(Header()->_root) : nullptr;
+}
+
+// 把区域中修改过的页写回文件
+void SharedHeap::Sync()
+{
+    msync(_base, _bytes, MS_SYNC);
+}
+
+// 拿区域的锁
+void SharedHeap::Lock()
+{
+    int err = pthread_mutex_lock(&Header()->_mtx);
+    if (err == EOWNERDEAD)
+    {// 上一个持有者拿着锁死掉了，元数据可能改到一半，修复好之后让锁恢复正常
+        Repair();
+        pthread_mutex_consistent(&Header()->_mtx);
+        err = 0;
+    }
+    assert(err == 0);   // 修复之后一定会恢复，不会出现ENOTRECOVERABLE
+    (void)err;
+}
+
+void SharedHeap::Unlock()
+{
+    pthread_mutex_unlock(&Header()->_mtx);
+}
+
+// 上一个使用区域的进程崩溃之后修复
+bool SharedHeap::Recover()
+{
+    // 锁里记着的是上一次打开区域时的持有者，调用者已经独占了区域，直接重新初始化
+    InitSharedMutex(&Header()->_mtx);
+    return Repair();
+}
+
+// 崩溃时正在修改元数据的话修复
+bool SharedHeap::Repair()
+{
+    SharedHeapHeader* header = Header();
+    if (header->_busy.load(std::memory_order_relaxed) == 0)
+    {// 崩溃时不在修改元数据，元数据是完整的
+        return false;
+    }
+
+    /* 崩溃时还有一段刚取出来没交出去：小块空间的页已经挂到桶上的话桶的链表头就是它的第一块，
+       否则大块空间还没返回给调用者，小块空间的页还没挂到桶上，都没人能找到，标记成空闲还回去
+       段在切分到一半时崩溃的话，首页的_n可能还是切分前的页数，整段都是空闲的，下面会合并成一段 */
+    size_t pending = header->_pending;
+    if (pending != 0 && pending < header->_pageNum)
+    {
+        SharedPage& head = Page(pending);
+        bool published = head._state == SHARED_PAGE_SMALL && head._index < FREE_LIST_NUM
+            && header->_freeLists[head._index] == (pending << PAGE_SHIFT);
+        if (!published && head._n > 0 && pending + head._n <= header->_pageNum)
+        {
+            head._state = Page(pending + head._n - 1)._state = SHARED_PAGE_FREE;
+        }
+    }
+    header->_pending = 0;
+
+    /* 页表中每一段的首页记着段的页数，按段从前往后走一遍，
+       修改到一半的段要么还是空闲的，要么已经标记成了使用中，都是完整的一段，
+       相邻的空闲段合并成一段重新挂起来，使用中的段重新统计字节数 */
+    for (size_t i = 0; i < SHARED_RUN_LIST_NUM; ++i)
+    {
+        header->_runLists[i] = 0;
+    }
+    header->_usedBytes = 0;
+
+    size_t id = MetaPages();
+    while (id < header->_pageNum)
+    {
+        size_t n = Page(id)._n;
+        if (n == 0 || id + n > header->_pageNum)
+        {// 不应该出现，当成使用中的一页跳过去，宁可泄漏
+            Page(id)._n = 1;
+            Page(id)._state = SHARED_PAGE_LARGE;
+            n = 1;
+        }
+
+        if (Page(id)._state != SHARED_PAGE_FREE)
+        {
+            header->_usedBytes += n << PAGE_SHIFT;
+            id += n;
+            continue;
+        }
+
+        size_t first = id;
+        id += n;
+        while (id < header->_pageNum && Page(id)._state == SHARED_PAGE_FREE
+            && Page(id)._n > 0 && id + Page(id)._n <= header->_pageNum)
+        {
+            id += Page(id)._n;
+        }
+
+        SharedPage& head = Page(first);
+        SharedPage& tail = Page(id - 1);
+        head._n = tail._n = (uint32_t)(id - first);
+        head._state = tail._state = SHARED_PAGE_FREE;
+        PushRun(first);
+    }
+
+    /* 桶中的链表都是先写好块再挂上去的，崩溃时最多丢掉正在申请释放的那一块，
+       保险起见再检查一遍：块必须落在这个桶的小块页中，链表不能成环，不对就从这里截断 */
+    for (size_t i = 0; i < FREE_LIST_NUM; ++i)
+    {
+        size_t limit = _bytes / sizeof(size_t);    // 块至少8字节，比这还多一定是成环了
+        size_t* link = &header->_freeLists[i];
+        for (size_t count = 0; *link != 0; link = &BlockNext(*link), ++count)
+        {
+            size_t offset = *link;
+            SharedPage& page = Page(offset >> PAGE_SHIFT);
+            if (count >= limit || offset >= _bytes || page._state != SHARED_PAGE_SMALL || page._index != i)
+            {
+                *link = 0;
+                break;
+            }
+        }
+    }
+
+    header->_busy.store(0, std::memory_order_release);
+    return true;
+}
+
+#endif
@@ -0,0 +1,183 @@
+#pragma once
+#include "Common.h"
+
+#ifndef _WIN32
+
+#include <pthread.h>
+
+/* 多个进程共享的分配域：整块共享内存(memfd或者shm_open)被多个进程映射，
+   每个进程映射到的地址可能不一样，所以区域内的所有元数据都用相对区域起始地址的偏移量，不存指针，
+   一个进程申请的对象可以直接交给另一个进程使用和释放，不用拷贝
+
+   区域的布局：[SharedHeapHeader | 页表 | 数据页...]，按页对齐
+   锁放在区域头部，是进程间共享的，所有操作都在这把锁里完成，不经过各个进程自己的tc/cc/pc
+   锁是健壮的：持有锁的进程死掉之后，下一个拿锁的进程会先修复元数据，其他进程不会一直等下去
+
+   区域也可以是一个文件(持久化分配域)：每次都映射到同一个地址，对象之间可以直接存指针，
+   进程重启之后重新映射文件、通过根指针找到原来的数据结构即可，不用重建任何对象
+*/
+
+static const uint64_t SHARED_HEAP_MAGIC = 0x50414548444D4343ull;   // "CCMDHEAP"
+
+// 持久化分配域默认映射到的地址，64位下这里一般不会被占用
+static const size_t PERSISTENT_HEAP_BASE = sizeof(void*) == 8 ? (size_t)0x200000000000ull : 0;
+
+// 页的状态
+enum SharedPageState : uint8_t
+{
+    SHARED_PAGE_META,   // 区域头部和页表占用的页
+    SHARED_PAGE_FREE,   // 空闲
+    SHARED_PAGE_SMALL,  // 切成了小块空间
+    SHARED_PAGE_LARGE   // 整段给了一个大块空间
+};
+
+/* 页表中每一页的信息，页号都是相对区域起始地址的，0号页是区域头部，所以0可以表示空
+   一段连续的页：首页和尾页的_n都是段的页数，空闲段通过首页的_prev/_next串起来 */
+struct SharedPage
+{
+    uint32_t _n = 0;
+    uint32_t _prev = 0;
+    uint32_t _next = 0;
+    uint16_t _index = 0;    // 小块空间所在的桶
+    uint8_t _state = SHARED_PAGE_META;
+};
+
+// 空闲段按页数挂在RUN_LIST_NUM个链表中，最后一个链表挂所有不少于PAGE_NUM页的段
+static const size_t SHARED_RUN_LIST_NUM = PAGE_NUM + 1;
+
+// 区域头部，所有成员都是偏移量或者页号
+struct SharedHeapHeader
+{
+    uint64_t _magic;
+    size_t _bytes;          // 区域总字节数
+    size_t _pageNum;        // 区域总页数
+    size_t _tableOffset;    // 页表的偏移量
+    size_t _baseAddress;    // 建好分配域时区域的地址，持久化分配域每次都映射到这里
+    size_t _root;           // 根对象的偏移量，0表示没有
+
+    pthread_mutex_t _mtx;   // 进程间共享的健壮锁，持有者死掉之后下一个拿锁的进程会收到EOWNERDEAD
+    std::atomic<uint32_t> _busy;    // 正在修改元数据，进程在这期间崩溃的话下次打开时要修复
+
+    size_t _freeLists[FREE_LIST_NUM];       // 每个桶空闲块的链表，存第一块的偏移量，0表示空
+    uint32_t _runLists[SHARED_RUN_LIST_NUM];    // 空闲段链表，存首页的页号，0表示空
+    size_t _usedBytes;      // 分配出去的页的字节数
+
+    /* 刚从空闲段中取出来、还没交出去的段的首页号，0表示没有：
+       大块空间返回给调用者之前、小块空间的页挂到桶上之前进程崩溃的话，修复时把这一段还回去 */
+    size_t _pending;
+};
+
+// 共享分配域在当前进程中的句柄，区域本身不属于任何一个进程
+class SharedHeap
+{
+public:
+    /* 映射fd对应的区域，bytes为0表示区域已经建好了，从头部读大小
+       format为true时在区域中建好空的分配域，base不为空时必须映射到base，被占用时抛出std::bad_alloc */
+    SharedHeap(int fd, size_t bytes, bool format, void* base = nullptr);
+
+    ~SharedHeap();
+
+    // 区域是不是已经建好的分配域
+    bool Valid() const;
+
+    // bytes字节的区域能不能建成分配域，建之前先检查，不用等映射好了才发现
+    static bool Formattable(size_t bytes);
+
+    void* Allocate(size_t size);    // 申请size大小的空间，区域用完时抛出std::bad_alloc
+
+    void Deallocate(void* obj);     // 释放obj，可以是任何一个进程申请的
+
+    // 区域内地址和偏移量互相转换，在进程之间传递对象时只能传偏移量
+    size_t ToOffset(const void* ptr) const
+    {
+        assert(Contains(ptr));
+        return (const char*)ptr - _base;
+    }
+
+    void* ToPointer(size_t offset) const
+    {
+        assert(offset < _bytes);
+        return _base + offset;
+    }
+
+    bool Contains(const void* ptr) const
+    {
+        return (const char*)ptr >= _base && (const char*)ptr < _base + _bytes;
+    }
+
+    int Fd() const
+    {
+        return _fd;
+    }
+
+    // 分配出去的页的字节数
+    size_t UsedBytes();
+
+    // 根对象，进程重启之后通过它找到原来的数据结构
+    void SetRoot(void* root);
+    void* Root();
+
+    // 把区域中修改过的页写回文件
+    void Sync();
+
+    /* 上一个使用区域的进程崩溃之后，由独占区域的进程调用：重置锁，再调用Repair修复元数据，返回是否做了修复
+       多个进程同时使用的区域不用调用，持有锁的进程死掉之后下一个拿锁的进程会自己修复 */
+    bool Recover();
+
+private:
+    friend class SharedHeapLock;
+
+    // 拿区域的锁，上一个持有者拿着锁死掉了就先修复元数据
+    void Lock();
+    void Unlock();
+
+    /* 如果崩溃时正在修改元数据，就把还没交出去的段还回去，按页表重建空闲段链表，检查各个桶的链表，
+       最多泄漏崩溃时正在申请释放的那一块，不会重复分配，返回是否做了修复，调用时要独占区域或者持有锁 */
+    bool Repair();
+
+    SharedHeapHeader* Header() const
+    {
+        return (SharedHeapHeader*)_base;
+    }
+
+    SharedPage& Page(size_t id) const
+    {
+        return ((SharedPage*)(_base + Header()->_tableOffset))[id];
+    }
+
+    // 偏移量对应的空闲块的下一块，同样存偏移量
+    size_t& BlockNext(size_t offset) const
+    {
+        return *(size_t*)(_base + offset);
+    }
+
+    // 在区域中建好空的分配域
+    void Format();
+
+    // 区域头部和页表占了多少页，之后都是数据页
+    size_t MetaPages() const
+    {
+        size_t tableEnd = Header()->_tableOffset + Header()->_pageNum * sizeof(SharedPage);
+        return SizeClass::_RoundUp(tableEnd, 1 << PAGE_SHIFT) >> PAGE_SHIFT;
+    }
+
+    // 把从first开始的n页标记成一个空闲段，和左右相邻的空闲段合并后挂到链表中
+    void FreeRun(size_t first, size_t n);
+
+    // 取出一个k页的段并标记成state，没有足够大的空闲段时抛出std::bad_alloc
+    size_t AllocRun(size_t k, SharedPageState state);
+
+    // 把空闲段挂到对应的链表中/从链表中删掉
+    void PushRun(size_t first);
+    void EraseRun(size_t first);
+
+    SharedHeap(const SharedHeap& copy) = delete;
+    SharedHeap& operator=(const SharedHeap& copy) = delete;
+
+private:
+    char* _base = nullptr;  // 区域在当前进程中的地址
+    size_t _bytes = 0;
+    int _fd = -1;
+};
+
+#endif
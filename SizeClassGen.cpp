@@ -0,0 +1,271 @@
+/* 根据负载的size直方图生成桶的划分（SizeClassTable.h）
+
+   用法：SizeClassGen [直方图文件] [桶个数上限] [最大内碎片率] > SizeClassTable.h
+   直方图文件每行是"size count"，#开头的行是注释；不给文件时按每个size出现次数相同处理
+   生成之后用 -DUSE_SIZE_CLASS_TABLE 编译，SizeClass就会改用生成的桶
+
+   目标是在桶个数不超过上限的前提下，让总浪费最小：
+   总浪费 = Σ count(size) * (桶大小 - size)            内碎片
+          + Σ count(size) * span尾部不够一块的空间 / 块数  span尾部浪费（分摊到每个块）
+   同时限制相邻两个桶的差值不超过 桶大小 * 最大内碎片率，保证直方图中没有出现的size也不会浪费太多
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#undef USE_SIZE_CLASS_TABLE     // 生成器本身要用默认的桶划分作对比
+#include "Common.h"
+
+/* 桶大小只能取这些格点，和默认桶划分的对齐规则一样：
+   128B以内按8B一格，1024B以内按16B一格，8KB以内按128B一格，64KB以内按1KB一格，之后按8KB一格
+   这样生成的桶仍然满足默认划分下的对齐，比如超过128B的块至少16B对齐 */
+static const size_t GRID_ZONE_NUM = 5;
+static const size_t GRID_LIMIT[GRID_ZONE_NUM] = { 128, 1024, 8 * 1024, 64 * 1024, MAX_BYTES };
+static const size_t GRID_ALIGN[GRID_ZONE_NUM] = { 8, 16, 128, 1024, 8 * 1024 };
+
+static size_t GridNum()   // 格点的个数
+{
+    size_t num = 0, prev = 0;
+    for (size_t z = 0; z < GRID_ZONE_NUM; ++z)
+    {
+        num += (GRID_LIMIT[z] - prev) / GRID_ALIGN[z];
+        prev = GRID_LIMIT[z];
+    }
+    return num;
+}
+static const size_t GRID_NUM = GridNum();
+
+static size_t GridSize(size_t i)   // 第i个格点(从1开始)的大小
+{
+    size_t prev = 0;
+    for (size_t z = 0; z < GRID_ZONE_NUM; ++z)
+    {
+        size_t num = (GRID_LIMIT[z] - prev) / GRID_ALIGN[z];
+        if (i <= num)
+        {
+            return prev + i * GRID_ALIGN[z];
+        }
+        i -= num;
+        prev = GRID_LIMIT[z];
+    }
+    return MAX_BYTES;
+}
+
+static size_t GridIndex(size_t size)   // size向上取到第几个格点
+{
+    size_t index = 0, prev = 0;
+    for (size_t z = 0; z < GRID_ZONE_NUM; ++z)
+    {
+        if (size <= GRID_LIMIT[z])
+        {
+            return index + (size - prev + GRID_ALIGN[z] - 1) / GRID_ALIGN[z];
+        }
+        index += (GRID_LIMIT[z] - prev) / GRID_ALIGN[z];
+        prev = GRID_LIMIT[z];
+    }
+    return index;
+}
+
+static size_t GridAlign(size_t size)   // size所在格点的对齐数
+{
+    size_t z = 0;
+    while (z + 1 < GRID_ZONE_NUM && size > GRID_LIMIT[z])
+    {
+        ++z;
+    }
+    return GRID_ALIGN[z];
+}
+
+static bool IsPowerOfTwo(size_t size)
+{
+    return (size & (size - 1)) == 0;
+}
+
+// 在默认页数的[1, 2]倍之间选一个span尾部浪费比例最小的页数
+static size_t BestMovePage(size_t size)
+{
+    size_t best = SizeClass::NumMovePage(size);
+    size_t bestTail = (best << PAGE_SHIFT) % size;
+    for (size_t k = best + 1; k <= 2 * SizeClass::NumMovePage(size) && k < PAGE_NUM; ++k)
+    {
+        size_t tail = (k << PAGE_SHIFT) % size;
+        if (tail * best < bestTail * k)     // tail / k < bestTail / best
+        {
+            best = k;
+            bestTail = tail;
+        }
+    }
+    return best;
+}
+
+// 每个块分摊到的span尾部浪费
+static double TailWastePerObj(size_t size)
+{
+    size_t bytes = BestMovePage(size) << PAGE_SHIFT;
+    return (double)(bytes % size) / (bytes / size);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t budget = argc > 2 ? strtoul(argv[2], nullptr, 10) : 208;
+    double maxWaste = argc > 3 ? atof(argv[3]) : 0.125;
+
+    // count[i]/sum[i]：向上取整到第i个格点的size的出现次数，以及这些size的总字节数
+    std::vector<double> count(GRID_NUM + 1, 0), sum(GRID_NUM + 1, 0);
+    double total = 0;
+
+    if (argc > 1)
+    {
+        FILE* fp = fopen(argv[1], "r");
+        if (fp == nullptr)
+        {
+            fprintf(stderr, "cannot open %s\n", argv[1]);
+            return 1;
+        }
+
+        char line[256];
+        while (fgets(line, sizeof(line), fp))
+        {
+            size_t size = 0;
+            double n = 0;
+            if (line[0] == '#' || sscanf(line, "%zu %lf", &size, &n) != 2 || size == 0 || size > MAX_BYTES)
+            {
+                continue;
+            }
+            count[GridIndex(size)] += n;
+            sum[GridIndex(size)] += n * size;
+            total += n;
+        }
+        fclose(fp);
+    }
+
+    // 每个格点再加一点先验次数，直方图中没出现的size也会被考虑到
+    double prior = total > 0 ? total / GRID_NUM * 0.01 : 1;
+    for (size_t i = 1; i <= GRID_NUM; ++i)
+    {
+        count[i] += prior;
+        sum[i] += prior * GridSize(i);
+    }
+
+    // 前缀和，cost(p, i)表示桶i服务(GridSize(p), GridSize(i)]这些size的浪费
+    std::vector<double> preCount(GRID_NUM + 1, 0), preSum(GRID_NUM + 1, 0);
+    for (size_t i = 1; i <= GRID_NUM; ++i)
+    {
+        preCount[i] = preCount[i - 1] + count[i];
+        preSum[i] = preSum[i - 1] + sum[i];
+    }
+    std::vector<double> tailWaste(GRID_NUM + 1, 0);
+    for (size_t i = 1; i <= GRID_NUM; ++i)
+    {
+        tailWaste[i] = TailWastePerObj(GridSize(i));
+    }
+    auto cost = [&](size_t p, size_t i) {
+        double n = preCount[i] - preCount[p];
+        return GridSize(i) * n - (preSum[i] - preSum[p]) + tailWaste[i] * n;
+    };
+
+    /* dp[j][i]：用j个桶覆盖[1, GridSize(i)]，并且最后一个桶是GridSize(i)时的最小浪费
+       2的幂必须是桶（ConcurrentAllocator靠它满足对齐），所以转移时不能跨过2的幂 */
+    const double INF = 1e300;
+    std::vector<std::vector<double>> dp(budget + 1, std::vector<double>(GRID_NUM + 1, INF));
+    std::vector<std::vector<size_t>> from(budget + 1, std::vector<size_t>(GRID_NUM + 1, 0));
+    dp[0][0] = 0;
+
+    for (size_t j = 1; j <= budget; ++j)
+    {
+        for (size_t i = 1; i <= GRID_NUM; ++i)
+        {
+            size_t size = GridSize(i);
+            size_t maxStep = std::max(GridAlign(size), (size_t)(size * maxWaste));
+
+            for (size_t p = i; p-- > 0; )
+            {
+                if (p > 0 && size - GridSize(p) > maxStep)
+                {
+                    break;
+                }
+                if (p == 0 && size != 8)
+                {// 第一个桶只能是8B
+                    break;
+                }
+                if (dp[j - 1][p] < INF)
+                {
+                    double c = dp[j - 1][p] + cost(p, i);
+                    if (c < dp[j][i])
+                    {
+                        dp[j][i] = c;
+                        from[j][i] = p;
+                    }
+                }
+                if (p > 0 && IsPowerOfTwo(GridSize(p)))
+                {// 不能跳过2的幂
+                    break;
+                }
+            }
+        }
+    }
+
+    // 最后一个桶必须是MAX_BYTES，在所有桶个数里选浪费最小的
+    size_t bestJ = 0;
+    for (size_t j = 1; j <= budget; ++j)
+    {
+        if (dp[j][GRID_NUM] < INF && (bestJ == 0 || dp[j][GRID_NUM] < dp[bestJ][GRID_NUM]))
+        {
+            bestJ = j;
+        }
+    }
+    if (bestJ == 0)
+    {
+        fprintf(stderr, "no size classes within %zu buckets, try a larger budget or max waste\n", budget);
+        return 1;
+    }
+
+    std::vector<size_t> classes;
+    for (size_t j = bestJ, i = GRID_NUM; j > 0; i = from[j][i], --j)
+    {
+        classes.push_back(GridSize(i));
+    }
+    std::reverse(classes.begin(), classes.end());
+
+    // 和默认的桶划分对比一下浪费
+    double defaultCost = 0;
+    for (size_t i = 1; i <= GRID_NUM; ++i)
+    {
+        size_t size = SizeClass::RoundUp(GridSize(i));
+        size_t bytes = SizeClass::NumMovePage(size) << PAGE_SHIFT;
+        defaultCost += size * count[i] - sum[i] + (double)(bytes % size) / (bytes / size) * count[i];
+    }
+    fprintf(stderr, "%zu size classes, waste %.2f%% of requested bytes (default classes: %.2f%%)\n",
+        classes.size(), 100 * dp[bestJ][GRID_NUM] / preSum[GRID_NUM], 100 * defaultCost / preSum[GRID_NUM]);
+
+    printf("#pragma once\n\n");
+    printf("// 由SizeClassGen根据负载直方图生成，不要手动修改\n\n");
+    printf("static const size_t SIZE_CLASS_NUM = %zu;\n\n", classes.size());
+
+    printf("// 每个桶的块大小\nstatic constexpr size_t SIZE_CLASS_BYTES[SIZE_CLASS_NUM] = {");
+    for (size_t i = 0; i < classes.size(); ++i)
+    {
+        printf("%s%s%zu", i ? "," : "", i % 12 ? " " : "\n    ", classes[i]);
+    }
+    printf("\n};\n\n");
+
+    // tc单次向cc申请的块数上限沿用默认规则，但不超过一个span能切出的块数
+    printf("// tc单次向cc批量申请的块数上限\nstatic constexpr size_t SIZE_CLASS_MOVE_NUM[SIZE_CLASS_NUM] = {");
+    for (size_t i = 0; i < classes.size(); ++i)
+    {
+        size_t objs = (BestMovePage(classes[i]) << PAGE_SHIFT) / classes[i];
+        printf("%s%s%zu", i ? "," : "", i % 12 ? " " : "\n    ", std::max((size_t)1, std::min(SizeClass::NumMoveSize(classes[i]), objs)));
+    }
+    printf("\n};\n\n");
+
+    printf("// cc向pc申请span的页数\nstatic constexpr size_t SIZE_CLASS_MOVE_PAGE[SIZE_CLASS_NUM] = {");
+    for (size_t i = 0; i < classes.size(); ++i)
+    {
+        printf("%s%s%zu", i ? "," : "", i % 12 ? " " : "\n    ", BestMovePage(classes[i]));
+    }
+    printf("\n};\n");
+
+    return 0;
+}
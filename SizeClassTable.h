@@ -0,0 +1,71 @@
+#pragma once
+
+// 由SizeClassGen根据负载直方图生成，不要手动修改
+
+static const size_t SIZE_CLASS_NUM = 205;
+
+// 每个桶的块大小
+static constexpr size_t SIZE_CLASS_BYTES[SIZE_CLASS_NUM] = {
+    8, 16, 24, 32, 40, 48, 56, 64, 72, 80, 88, 96,
+    104, 112, 120, 128, 144, 160, 176, 192, 208, 224, 240, 256,
+    272, 288, 304, 320, 336, 352, 368, 384, 400, 416, 432, 448,
+    464, 480, 496, 512, 528, 544, 560, 576, 592, 608, 624, 640,
+    656, 672, 688, 704, 720, 736, 752, 768, 784, 800, 816, 832,
+    848, 864, 880, 896, 912, 928, 944, 960, 976, 992, 1008, 1024,
+    1152, 1280, 1408, 1536, 1664, 1792, 1920, 2048, 2176, 2304, 2432, 2560,
+    2688, 2816, 2944, 3072, 3200, 3328, 3456, 3584, 3712, 3840, 3968, 4096,
+    4224, 4352, 4480, 4608, 4736, 4864, 4992, 5120, 5248, 5376, 5504, 5632,
+    5760, 5888, 6016, 6144, 6272, 6400, 6528, 6656, 6784, 6912, 7040, 7168,
+    7296, 7424, 7552, 7680, 7808, 7936, 8192, 9216, 10240, 11264, 12288, 13312,
+    14336, 15360, 16384, 17408, 18432, 19456, 20480, 21504, 22528, 23552, 24576, 25600,
+    26624, 27648, 28672, 29696, 30720, 31744, 32768, 33792, 34816, 35840, 36864, 37888,
+    38912, 39936, 40960, 41984, 43008, 44032, 45056, 46080, 47104, 48128, 49152, 50176,
+    51200, 52224, 53248, 54272, 55296, 57344, 58368, 59392, 60416, 61440, 62464, 63488,
+    65536, 73728, 81920, 90112, 98304, 106496, 114688, 122880, 131072, 139264, 147456, 155648,
+    163840, 172032, 180224, 188416, 196608, 204800, 212992, 221184, 229376, 237568, 245760, 253952,
+    262144
+};
+
+// tc单次向cc批量申请的块数上限
+static constexpr size_t SIZE_CLASS_MOVE_NUM[SIZE_CLASS_NUM] = {
+    512, 512, 341, 512, 512, 512, 512, 512, 455, 512, 465, 512,
+    512, 512, 512, 512, 512, 512, 512, 512, 512, 512, 512, 512,
+    512, 512, 512, 512, 512, 512, 512, 512, 512, 512, 512, 512,
+    512, 512, 512, 512, 512, 512, 512, 512, 512, 512, 512, 512,
+    512, 512, 512, 512, 512, 512, 512, 512, 512, 512, 512, 512,
+    512, 512, 512, 512, 512, 512, 512, 512, 512, 512, 512, 256,
+    227, 204, 186, 170, 157, 146, 136, 128, 120, 113, 107, 102,
+    97, 93, 89, 85, 81, 78, 75, 73, 70, 68, 64, 64,
+    62, 60, 58, 56, 55, 53, 52, 51, 49, 48, 47, 46,
+    45, 44, 43, 42, 41, 40, 40, 39, 38, 37, 37, 36,
+    35, 35, 34, 34, 33, 32, 32, 28, 25, 23, 21, 19,
+    18, 17, 16, 15, 14, 13, 12, 12, 11, 11, 10, 10,
+    9, 9, 9, 8, 8, 8, 8, 7, 7, 7, 7, 6,
+    6, 6, 6, 6, 6, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2
+};
+
+// cc向pc申请span的页数
+static constexpr size_t SIZE_CLASS_MOVE_PAGE[SIZE_CLASS_NUM] = {
+    1, 1, 1, 2, 4, 3, 4, 4, 4, 5, 5, 6,
+    8, 7, 8, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+    17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28,
+    29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52,
+    53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 32,
+    36, 35, 33, 33, 39, 35, 45, 32, 34, 36, 38, 35,
+    42, 33, 46, 33, 50, 39, 54, 35, 58, 45, 31, 32,
+    33, 34, 35, 36, 37, 38, 39, 35, 41, 42, 43, 33,
+    45, 46, 47, 33, 49, 50, 51, 39, 53, 54, 55, 35,
+    57, 58, 59, 45, 61, 31, 32, 36, 35, 33, 33, 39,
+    35, 45, 32, 34, 36, 38, 30, 42, 33, 46, 30, 50,
+    39, 54, 35, 29, 30, 31, 32, 33, 34, 35, 36, 37,
+    38, 39, 30, 41, 42, 43, 33, 45, 46, 47, 30, 49,
+    50, 51, 26, 40, 27, 28, 50, 29, 37, 30, 46, 31,
+    32, 27, 30, 22, 24, 26, 28, 30, 32, 34, 36, 38,
+    40, 42, 44, 46, 48, 50, 52, 54, 56, 58, 60, 62,
+    64
+};
@@ -0,0 +1,81 @@
+#pragma once
+#include <new>
+#include "Common.h"
+
+/* 按标签统计内存：每个子系统用一个标签，标签下申请的小块空间只从这个标签专用的span中切，
+   所以统计和预算都是按span做的：cc切一个span、大块空间申请一个span的时候记账，span还给pc的时候销账，
+   tc的快路径上没有任何统计的开销
+   统计到的是标签占着的span的字节数，包括span中还没分配出去的块，也就是这个子系统实际让堆多占的内存
+   0号标签是没有标签的申请，独立的Heap和共享分配域不统计
+*/
+
+static const size_t TAG_NUM = 16;   // 最多多少个标签，包括0号
+
+/* 标签超出预算时调用的回调，tag是超出预算的标签，usedBytes是已经占用的字节数，requestBytes是这次要多占用的字节数
+   回调返回true允许这次超出预算(比如只是记一下日志)，返回false这次申请抛出std::bad_alloc */
+typedef bool (*ConcurrentTagBudgetHandler)(size_t tag, size_t usedBytes, size_t requestBytes);
+
+// 超出预算抛出的异常，和超过硬上限区分开，不会交给OOM回调
+struct TagBudgetExceeded : public std::bad_alloc
+{
+    const char* what() const noexcept override
+    {
+        return "tag budget exceeded";
+    }
+};
+
+// 一个标签的统计数据，每个标签独占缓存行，不同标签记账的时候不会互相影响
+struct alignas(CACHE_LINE) TagStats
+{
+    std::atomic<size_t> _bytes;     // 占用的span的字节数
+    std::atomic<size_t> _peak;      // _bytes的最大值
+    std::atomic<size_t> _budget;    // 预算，0表示没有预算
+};
+
+// 所有标签的统计数据，静态存储区的atomic初始都是0
+static TagStats s_tagStats[TAG_NUM];
+static std::atomic<ConcurrentTagBudgetHandler> s_tagBudgetHandler{ nullptr };
+
+static inline TagStats& GetTagStats(size_t tag)
+{
+    assert(tag < TAG_NUM);
+    return s_tagStats[tag];
+}
+
+/* 标签tag要多占用bytes字节之前调用，超出预算时交给回调决定，没有回调或者回调不允许时抛出TagBudgetExceeded
+   检查和记账不是一个原子操作，多个线程同时切span时最多超出几个span */
+static inline void CheckTagBudget(size_t tag, size_t bytes)
+{
+    TagStats& stats = GetTagStats(tag);
+    size_t budget = stats._budget.load(std::memory_order_relaxed);
+    size_t used = stats._bytes.load(std::memory_order_relaxed);
+    if (budget == 0 || used + bytes <= budget)
+    {
+        return;
+    }
+
+    ConcurrentTagBudgetHandler handler = s_tagBudgetHandler.load(std::memory_order_acquire);
+    if (handler == nullptr || !handler(tag, used, bytes))
+    {
+        throw TagBudgetExceeded();
+    }
+}
+
+// 标签tag拿到了bytes字节的span
+static inline void ChargeTag(size_t tag, size_t bytes)
+{
+    TagStats& stats = GetTagStats(tag);
+    size_t used = stats._bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+
+    size_t peak = stats._peak.load(std::memory_order_relaxed);
+    while (used > peak && !stats._peak.compare_exchange_weak(peak, used, std::memory_order_relaxed))
+    {}
+}
+
+// 标签tag的span还给了pc
+static inline void UnchargeTag(size_t tag, size_t bytes)
+{
+    TagStats& stats = GetTagStats(tag);
+    assert(stats._bytes.load(std::memory_order_relaxed) >= bytes);
+    stats._bytes.fetch_sub(bytes, std::memory_order_relaxed);
+}
@@ -1,6 +1,7 @@
 #include "ThreadCache.h"
 #include "CentralCache.cpp"
 #include "PageCache.cpp"
+#include "Epoch.cpp"
 
 void* ThreadCache::Allocate(size_t size)    // 线程申请size大小的空间
 {
@@ -15,6 +16,10 @@ void* ThreadCache::Allocate(size_t size)    // 线程申请size大小的空间
     {   // 自由链表不为空，可以直接从自由链表中获取空间
         return _freeLists[index].Pop();
     }
+    else if (CollectRemoteFrees(index))
+    {   // 自由链表为空，但其他线程还回来了本线程申请的块，先用这些块，不用去加cc的桶锁
+        return _freeLists[index].Pop();
+    }
     else
     {   // 自由链表为空，需要向CentralCache申请空间
         // alignSize参数意味着 向CentralCache申请空间的时候不需要考虑对齐问题，直接申请整块大小
@@ -27,33 +32,164 @@ void ThreadCache::Deallocate(void* obj, size_t size)   // 回收线程中大小
    assert(obj); // 回收的空间不能为空
    assert(size <= MAX_BYTES);   // 回收空间大小不能超过256KB
 
-   size_t index = SizeClass::Index(size);   // 找到size对应的自由链表
-   _freeLists[index].Push(obj);     // 用对应自由链表回收空间
+   Deallocate(obj, SizeClass::Index(size), size);   // 找到size对应的自由链表回收空间
+}
 
-    // 当前桶中的块数大于等于单批次申请块数的时候归还空间
-    if (_freeLists[index].Size() >= _freeLists[index].MaxSize())
+// 所有自由链表中的块都还给cc
+void ThreadCache::ReleaseAll()
+{
+    ReclaimRetired(false);  // 已经安全的退休对象先放回来，一起还掉
+
+    for (size_t i = 0; i < FREE_LIST_NUM; ++i)
     {
-        ListTooLong(_freeLists[index], size);
+        CollectRemoteFrees(i);  // 别的线程还回来的也一起还掉
+
+        FreeList& list = _freeLists[i];
+        if (list.Size() > 0)
+        {
+            void* start = nullptr;
+            void* end = nullptr;
+            list.PopRange(start, end, list.Size());
+
+            // 只知道桶下标，块大小从span中取
+            size_t size = PageCache::GetInstance()->MapObjectToSpan(start)->_objSize;
+            CentralCache::GetInstance(_tag)->ReleaseListToSpans(start, size);
+        }
+
+        list.Batch() = BatchState();    // 空闲之后的需求未必和之前一样，重新慢开始
     }
 }
 
+// 线程退出时关掉tc
+void ThreadCache::Close()
+{
+    for (size_t i = 0; i < FREE_LIST_NUM; ++i)
+    {// 换成关掉的标记，之后RemoteFree看到它就不会再挂过来了
+        void* start = _remoteLists[i].exchange(ClosedList(), std::memory_order_acquire);
+        if (start != nullptr)
+        {
+            PushRemoteList(i, start);
+        }
+    }
+
+    ReleaseAll();   // 已经安全的退休对象也一起还掉
+
+    /* 没攒满的一批也封存，和还不安全的批一起交给别的线程，这个tc再也不会回收了
+       要放在ReleaseAll后面，不然刚交出去的批又被它收回来 */
+    if (_retireBatch != nullptr)
+    {
+        SealRetireBatch();
+    }
+    if (_retireHead != nullptr)
+    {
+        EpochManager::GetInstance()->Orphan(_retireHead, _retireTail);
+        _retireHead = _retireTail = nullptr;
+    }
+}
+
+// 其他线程释放本tc申请的obj空间
+bool ThreadCache::RemoteFree(void* obj, size_t size)
+{
+    assert(obj);
+    assert(size <= MAX_BYTES);
+
+    size_t index = SizeClass::Index(size);
+    std::atomic<void*>& head = _remoteLists[index];
+    std::atomic<size_t>& count = _remoteCounts[index];
+
+    /* 先占一个位置，链表中已经有一批了说明本线程一直没来取，可能已经不申请这个大小了，
+       块不再往这里攒，和本地释放一样由调用者的tc到高水位时还给cc */
+    if (count.fetch_add(1, std::memory_order_relaxed) >= SizeClass::NumMoveSize(size))
+    {
+        count.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // 无锁头插，失败说明有其他线程同时插入或者owner刚取走了链表，old会被更新成最新的头
+    void* old = head.load(std::memory_order_relaxed);
+    do
+    {
+        if (old == ClosedList())
+        {// 本tc所属的线程已经退出了
+            count.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        ObjNext(obj) = old;
+    } while (!head.compare_exchange_weak(old, obj, std::memory_order_release, std::memory_order_relaxed));
+
+    return true;
+}
+
+// 把其他线程挂过来的index桶的块收回到自由链表中
+bool ThreadCache::CollectRemoteFrees(size_t index)
+{
+    // 先不加屏障地看一眼，绝大多数时候是空的，关掉之后也不会再有块
+    void* head = _remoteLists[index].load(std::memory_order_relaxed);
+    if (head == nullptr || head == ClosedList())
+    {
+        return false;
+    }
+
+    // 整条链表一次性取走
+    PushRemoteList(index, _remoteLists[index].exchange(nullptr, std::memory_order_acquire));
+
+    return true;
+}
+
+// 从远程释放链表取下来的一串块挂到自由链表中
+void ThreadCache::PushRemoteList(size_t index, void* start)
+{
+    // 找到尾节点并统计块数
+    void* end = start;
+    size_t n = 1;
+    while (ObjNext(end) != nullptr)
+    {
+        end = ObjNext(end);
+        ++n;
+    }
+
+    _freeLists[index].PushRange(start, end, n);
+
+    // 取走的块都是挂之前就计过数的，减掉之后计数不会小于链表中的块数
+    _remoteCounts[index].fetch_sub(n, std::memory_order_relaxed);
+}
+
+// 线程退出时关掉线程的各个tc
+ThreadCacheHolder::~ThreadCacheHolder()
+{
+    if (!_active)
+    {
+        return;
+    }
+
+    for (size_t tag = 0; tag < TAG_NUM; ++tag)
+    {
+        if (pTLSTagCaches[tag] != nullptr)
+        {
+            pTLSTagCaches[tag]->Close();
+            pTLSTagCaches[tag] = nullptr;  // 之后其他thread_local析构时再申请释放会用新的tc
+        }
+    }
+    pTLSThreadCache = nullptr;
+}
+
 // ThreadCache中空间不够时，向CentralCache申请空间的接口
 void* ThreadCache::FetchFromCentralCache(size_t index, size_t alignSize)
 {// 慢开始反馈调节算法
 
-    // 通过MaxSize和NumMoveSize来控制当前给tc提供多少块alignSize大小的空间
-    size_t batchNum = std::min(_freeLists[index].MaxSize(), SizeClass::NumMoveSize(alignSize));
-    /*  MaxSize表示index位置的自由链表单次申请未到上限时，能够申请的最大块空间是多少
+    if (PageCache::GetInstance()->TakeSoftLimitHit())
+    {// 堆超过了软上限，本线程缓存的块、cc中没用过的span都还回去，pc中空闲页的物理内存还给系统
+        ReleaseAll();
+        CentralCache::GetInstance()->Trim(0);
+    }
+
+    /*  通过MaxSize和NumMoveSize来控制当前给tc提供多少块alignSize大小的空间
+        MaxSize表示index位置的自由链表单次申请未到上限时，能够申请的最大块空间是多少
         NumMoveSize表示tc单次向cc申请alignSize大小的空间块的最多块数是多少
-        二者取小，得到的就是本次要给tc提供多少块alignSize大小的空间
-        例如alignSize=8B，MaxSize=1，NumMoveSize=512，那就要给一块8B空间
-        即 没到上限就给MaxSize，到了上限就给上限的NumMoveSize
+        二者取小，得到的就是本次要给tc提供多少块alignSize大小的空间，MaxSize怎么增长由BATCH_POLICY决定
     */
-
-    if (batchNum == _freeLists[index].MaxSize())
-    {// 如果没有达到上限，那下次再申请这块空间的时候，可以多申请一块
-        _freeLists[index].MaxSize()++;  // 慢开始反馈调节算法的核心
-    }
+    size_t batchNum = BATCH_POLICY::FetchNum(_freeLists[index].Batch(), SizeClass::NumMoveSize(alignSize));
+    ALLOC_PROBE(tc_refill_begin, index, alignSize, batchNum);
 
     // 输出型参数，返回之后的结果就是tc想要的空间
     void* start = nullptr;
@@ -61,7 +197,8 @@ void* ThreadCache::FetchFromCentralCache(size_t index, size_t alignSize)
 
     // cout << "batchNum: " << batchNum << endl;
     // 返回值为实际获取到的块数
-    size_t actulNum = CentralCache::GetInstance()->FetchRangeObj(start, end, batchNum, alignSize);
+    size_t actulNum = CentralCache::GetInstance(_tag)->FetchRangeObj(start, end, batchNum, alignSize, this);
+    ALLOC_PROBE(tc_refill_end, index, alignSize, actulNum);
 
     // actualNum一定是大于等于1的，这是FetchRangeObj能保证的
     assert(actulNum >= 1);
@@ -86,9 +223,189 @@ void ThreadCache::ListTooLong(FreeList& list, size_t size)
     void* start = nullptr;
     void* end = nullptr;
 
-    // 获取MaxSize块空间
-    list.PopRange(start, end, list.MaxSize());
+    // 还多少块由BATCH_POLICY决定，链表中可能留下一些块
+    size_t n = BATCH_POLICY::FlushNum(list.Batch(), list.Size(), SizeClass::NumMoveSize(size));
+    ALLOC_PROBE(tc_flush_begin, SizeClass::Index(size), size, n);
+    list.PopRange(start, end, n);
 
     // 归还空间
-    CentralCache::GetInstance()->ReleaseListToSpans(start, size);
-}
\ No newline at end of file
+    CentralCache::GetInstance(_tag)->ReleaseListToSpans(start, size);
+    ALLOC_PROBE(tc_flush_end, SizeClass::Index(size), size, n);
+}
+
+// 退休的批也用定长内存池来申请
+static ObjectPool<RetireBatch>& RetireBatchPool()
+{
+    static ObjectPool<RetireBatch> batchPool;
+    return batchPool;
+}
+
+// obj从无锁数据结构中摘下来了，先攒起来
+void ThreadCache::Retire(void* obj)
+{
+    assert(obj);
+
+    if (_retireBatch == nullptr)
+    {
+        std::lock_guard<PoolMutex> lock(RetireBatchPool()._poolMtx);
+        _retireBatch = RetireBatchPool().New();
+    }
+    _retireBatch->_ptrs[_retireBatch->_n++] = obj;
+
+    if (_retireBatch->_n == RETIRE_BATCH_NUM)
+    {
+        SealRetireBatch();
+
+        // 每攒满一批才试着推进一次epoch，遍历所有读者的开销分摊到整批上
+        EpochManager::GetInstance()->TryAdvance();
+        ReclaimRetired(false);
+    }
+}
+
+// 封存正在攒的一批，挂到等待链表的末尾
+void ThreadCache::SealRetireBatch()
+{
+    // 批中的对象都是在读到这个epoch之前摘下来的
+    _retireBatch->_epoch = EpochManager::GetInstance()->Epoch();
+    if (_retireTail == nullptr)
+    {
+        _retireHead = _retireTail = _retireBatch;
+    }
+    else
+    {
+        _retireTail->_next = _retireBatch;
+        _retireTail = _retireBatch;
+    }
+    _retireBatch = nullptr;
+}
+
+// 收下退出的线程留下的批
+void ThreadCache::AdoptRetireOrphans()
+{
+    RetireBatch* batch = EpochManager::GetInstance()->TakeOrphans();
+    while (batch != nullptr)
+    {
+        RetireBatch* next = batch->_next;
+
+        // 等待链表要按epoch从小到大排，回收时遇到不安全的批才能直接停下
+        RetireBatch* prev = nullptr;
+        RetireBatch* cur = _retireHead;
+        while (cur != nullptr && cur->_epoch <= batch->_epoch)
+        {
+            prev = cur;
+            cur = cur->_next;
+        }
+        batch->_next = cur;
+        if (prev == nullptr)
+        {
+            _retireHead = batch;
+        }
+        else
+        {
+            prev->_next = batch;
+        }
+        if (cur == nullptr)
+        {
+            _retireTail = batch;
+        }
+
+        batch = next;
+    }
+}
+
+// 已经安全的退休对象放回自由链表
+void ThreadCache::ReclaimRetired(bool wait)
+{
+    if (wait && _retireBatch != nullptr)
+    {// 没攒满的一批也封存起来
+        SealRetireBatch();
+    }
+
+    AdoptRetireOrphans();   // 退出的线程留下的批也在这里回收
+
+    // 先封存的epoch小，前面的还不安全后面的也不会安全
+    while (_retireHead != nullptr)
+    {
+        if (!EpochManager::GetInstance()->Safe(_retireHead->_epoch))
+        {
+            if (!wait)
+            {
+                break;
+            }
+            // 等还在临界区里的读者出来
+            EpochManager::GetInstance()->TryAdvance();
+            std::this_thread::yield();
+            continue;
+        }
+
+        RetireBatch* batch = _retireHead;
+        _retireHead = batch->_next;
+        if (_retireHead == nullptr)
+        {
+            _retireTail = nullptr;
+        }
+
+        FreeRetireBatch(batch);
+
+        std::lock_guard<PoolMutex> lock(RetireBatchPool()._poolMtx);
+        RetireBatchPool().Delete(batch);
+    }
+}
+
+// 把一批退休对象放回自由链表
+void ThreadCache::FreeRetireBatch(RetireBatch* batch)
+{
+    // 同一个桶连续的对象先串成一段，一次PushRange挂到自由链表中
+    void* start = nullptr;
+    void* end = nullptr;
+    size_t n = 0;
+    size_t runSize = 0;
+    auto flush = [&]() {
+        if (n == 0)
+        {
+            return;
+        }
+        FreeList& list = _freeLists[SizeClass::Index(runSize)];
+        list.PushRange(start, end, n);
+        if (list.Size() >= list.HighWater())
+        {
+            ListTooLong(list, runSize);
+        }
+        n = 0;
+    };
+
+    for (size_t i = 0; i < batch->_n; ++i)
+    {
+        void* obj = batch->_ptrs[i];
+        Span* span = PageCache::GetInstance()->MapObjectToSpan(obj);
+        size_t size = span->_objSize;
+
+        if (size > MAX_BYTES)
+        {// 大块空间直接还给pc
+            ALLOC_PROBE(large_free, obj, size);
+            UnchargeTag(span->_tag, size);
+
+            PageCache::GetInstance()->_pageMtx.lock();
+            PageCache::GetInstance()->ReleaseSpanToPageCache(span);
+            PageCache::GetInstance()->_pageMtx.unlock();
+            continue;
+        }
+
+        if (n > 0 && size != runSize)
+        {
+            flush();
+        }
+        if (n == 0)
+        {
+            start = obj;
+        }
+        else
+        {
+            ObjNext(end) = obj;
+        }
+        end = obj;
+        runSize = size;
+        ++n;
+    }
+    flush();
+}
@@ -1,21 +1,109 @@
 #include "Common.h"
+#include "BatchPolicy.h"
+#include "TagStats.h"
+#include "Epoch.h"
 
 
 class ThreadCache
 {
 public:
+    // tag是这个tc属于的标签，一个线程的每个标签各有一个tc，块从这个标签的cc中取
+    explicit ThreadCache(size_t tag = 0)
+        : _tag(tag)
+    {// std::atomic默认构造不会初始化，这里手动置空
+        for (size_t i = 0; i < FREE_LIST_NUM; ++i)
+        {
+            _remoteLists[i].store(nullptr, std::memory_order_relaxed);
+            _remoteCounts[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
     void* Allocate(size_t size);    // 线程申请size大小的空间
 
     void Deallocate(void* obj, size_t size);   // 回收线程中大小为size的obj空间
 
+    // 桶下标已经算好的申请，自由链表为空时返回nullptr，由调用者走Allocate
+    void* TryAllocate(size_t index)
+    {
+        return _freeLists[index].Empty() ? nullptr : _freeLists[index].Pop();
+    }
+
+    // 桶下标已经算好的释放，size是块的大小
+    void Deallocate(void* obj, size_t index, size_t size)
+    {
+        assert(obj);
+        _freeLists[index].Push(obj);
+
+        // 当前桶中的块数到了高水位的时候归还空间
+        if (_freeLists[index].Size() >= _freeLists[index].HighWater())
+        {
+            ListTooLong(_freeLists[index], size);
+        }
+    }
+
+    /* 其他线程释放本tc申请的obj空间，无锁地挂到远程释放链表中，可以被任意线程调用
+       链表已经攒了一批没取走，或者本tc所属的线程已经退出时返回false，块由调用者放进自己的tc */
+    bool RemoteFree(void* obj, size_t size);
+
+    // 把其他线程挂过来的index桶的块一次性收回到自由链表中，返回是否收到了块
+    bool CollectRemoteFrees(size_t index);
+
     // ThreadCache中空间不够时，向CentralCache申请空间的接口
     void* FetchFromCentralCache(size_t index, size_t alignSize);
     
     // tc向cc归还List桶中的空间
     void ListTooLong(FreeList& list, size_t size);
 
+    // 所有自由链表中的块都还给cc，慢开始重新从1块开始，线程空闲时调用
+    void ReleaseAll();
+
+    /* 线程退出时调用：关掉远程释放链表，之后别的线程释放的块不再挂过来，缓存的块都还给cc
+       还不安全的退休对象交给EpochManager，由之后回收退休对象的线程放回它的tc */
+    void Close();
+
+    size_t Tag() const
+    {
+        return _tag;
+    }
+
+    // obj已经从无锁数据结构中摘下来了，等可能看到它的读者都离开临界区之后再放回自由链表
+    void Retire(void* obj);
+
+    // 已经没有读者能看到的退休对象放回自由链表，wait为true时等到本tc所有退休的对象都能放回去
+    void ReclaimRetired(bool wait);
+
 private:
+    // 封存正在攒的一批，挂到等待链表的末尾
+    void SealRetireBatch();
+
+    // 收下退出的线程留下的批，按epoch插到等待链表中
+    void AdoptRetireOrphans();
+
+    // 把一批退休对象放回自由链表，同一个桶连续的对象一次性挂上去
+    void FreeRetireBatch(RetireBatch* batch);
+
+    // 从远程释放链表取下来的start开头的一串块挂到index桶的自由链表中
+    void PushRemoteList(size_t index, void* start);
+
+    // 关掉的远程释放链表的头，不是任何块的地址
+    static void* ClosedList()
+    {
+        return reinterpret_cast<void*>(1);
+    }
+
     FreeList _freeLists[FREE_LIST_NUM];  // 哈希，每个桶表示个链表
+
+    // 其他线程释放回来的块，多个线程push，只有本线程一次性整体取走，所以不存在ABA问题
+    std::atomic<void*> _remoteLists[FREE_LIST_NUM];
+
+    // 远程释放链表中的块数，包括正在挂的，超过单次移动的块数就不再往里挂
+    std::atomic<size_t> _remoteCounts[FREE_LIST_NUM];
+
+    size_t _tag = 0;
+
+    RetireBatch* _retireBatch = nullptr;    // 正在攒的一批
+    RetireBatch* _retireHead = nullptr;     // 已经封存、等全局epoch推进的批，按封存的先后排列
+    RetireBatch* _retireTail = nullptr;
 };
 
 // TLS全局对象的指针，这样每个线程都能有一个独立的全局对象
@@ -24,4 +112,18 @@ private:
 // 定义为static是为了避免多个.cpp文件包含该文件的时候会发生链接错误
 
 // thread_local是C++11提供的，支持跨平台
-static thread_local ThreadCache* pTLSThreadCache = nullptr;
\ No newline at end of file
+// 当前线程正在用的tc，在ConcurrentTagScope里是这个标签的tc
+static thread_local ThreadCache* pTLSThreadCache = nullptr;
+
+// 当前线程每个标签的tc，0号是线程默认的tc，用到时才创建
+static thread_local ThreadCache* pTLSTagCaches[TAG_NUM] = { nullptr };
+
+// 线程退出时关掉线程的各个tc，别的线程之后释放的块走自己的tc，不会挂在没人收的链表上
+struct ThreadCacheHolder
+{
+    bool _active = false;   // 线程创建过tc
+
+    ~ThreadCacheHolder();
+};
+
+static thread_local ThreadCacheHolder tlsThreadCacheHolder;
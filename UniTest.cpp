@@ -1,4 +1,15 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <list>
+#include <map>
+#include <set>
+#include <stdexcept>
 #include "ConcurrentAlloc.h"
+#include "ConcurrentAllocator.h"
+#ifndef _WIN32
+    #include <sys/wait.h>
+#endif
 
 // 线程1执行方法
 void Alloc1()
@@ -132,6 +143,1565 @@ void BigAlloc()
     ConcurrentFree(p2);
 }
 
+// 线程1申请、线程2释放，线程1再申请的时候应该拿回自己的块
+void TestRemoteFree()
+{
+    std::vector<void*> vec;
+    std::mutex mtx;
+    std::condition_variable cv;
+    int step = 0;   // 0：线程1申请，1：线程2释放，2：线程1再申请
+
+    std::thread t1([&]() {
+        for (size_t i = 0; i < 100; ++i)
+        {
+            vec.push_back(ConcurrentAlloc(16));
+        }
+
+        std::unique_lock<std::mutex> lock(mtx);
+        step = 1;
+        cv.notify_all();
+        cv.wait(lock, [&]() { return step == 2; });
+
+        // 本线程的自由链表用完之后，会收回线程2挂过来的块
+        std::vector<void*> again;
+        size_t hit = 0;
+        for (size_t i = 0; i < 200; ++i)
+        {
+            void* ptr = ConcurrentAlloc(16);
+            if (std::find(vec.begin(), vec.end(), ptr) != vec.end())
+            {
+                ++hit;
+            }
+            again.push_back(ptr);
+        }
+        cout << "remote free reused: " << hit << "/" << vec.size() << endl;
+        assert(hit == vec.size());
+
+        for (auto e : again)
+        {
+            ConcurrentFree(e);
+        }
+    });
+
+    std::thread t2([&]() {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&]() { return step == 1; });
+        for (auto e : vec)
+        {
+            ConcurrentFree(e);  // 线程2从来没有申请过，tc为空也能释放
+        }
+        step = 2;
+        cv.notify_all();
+    });
+
+    t1.join();
+    t2.join();
+}
+
+// 申请块的线程退出或者不再申请这个大小之后，别的线程释放的块不能攒在它的远程释放链表中
+void TestRemoteFreeAfterExit()
+{
+    const size_t n = 20000;
+    std::vector<void*> vec(n);
+
+    // 短命的线程申请，主线程在它退出之后释放，释放的块要能被下一轮的线程复用
+    size_t first = 0;
+    for (size_t round = 0; round < 50; ++round)
+    {
+        std::thread t([&]() {
+            for (size_t i = 0; i < n; ++i)
+            {
+                vec[i] = ConcurrentAlloc(64);
+            }
+        });
+        t.join();
+
+        for (auto e : vec)
+        {
+            ConcurrentFree(e);
+        }
+
+        if (round == 0)
+        {
+            first = ConcurrentHeapBytes();
+        }
+    }
+    size_t last = ConcurrentHeapBytes();
+    cout << "heap after exited owners: " << first << " -> " << last << endl;
+    assert(last < first + 8 * 1024 * 1024);
+
+    // 申请的线程还活着但不再申请，远程释放链表攒满之后块走主线程的tc，主线程再申请时能复用
+    std::mutex mtx;
+    std::condition_variable cv;
+    int step = 0;   // 0：线程申请，1：主线程释放并再申请，2：线程退出
+    std::thread t([&]() {
+        for (size_t i = 0; i < n; ++i)
+        {
+            vec[i] = ConcurrentAlloc(64);
+        }
+
+        std::unique_lock<std::mutex> lock(mtx);
+        step = 1;
+        cv.notify_all();
+        cv.wait(lock, [&]() { return step == 2; });
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&]() { return step == 1; });
+    }
+
+    size_t before = ConcurrentHeapBytes();
+    for (auto e : vec)
+    {
+        ConcurrentFree(e);
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+        vec[i] = ConcurrentAlloc(64);
+    }
+    size_t after = ConcurrentHeapBytes();
+    cout << "heap with idle owner: " << before << " -> " << after << endl;
+    assert(after < before + n * 64 / 2);
+
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        step = 2;
+        cv.notify_all();
+    }
+    t.join();
+
+    for (auto e : vec)
+    {
+        ConcurrentFree(e);
+    }
+}
+
+// 在独立的Heap中申请释放，最后整体销毁
+void TestHeap()
+{
+    Heap* heap = HeapCreate();
+    std::vector<void*> vec;
+    for (size_t i = 0; i < 10000; ++i)
+    {
+        void* ptr = HeapAlloc(heap, i % 1024 + 1);
+        memset(ptr, 0xff, i % 1024 + 1);
+        vec.push_back(ptr);
+    }
+    for (size_t i = 0; i < vec.size(); i += 2)
+    {
+        HeapFree(heap, vec[i]);     // 释放一半，剩下的随Heap一起销毁
+    }
+    void* big = HeapAlloc(heap, 1024 * 1024);
+    HeapFree(heap, big);
+    HeapAlloc(heap, 300 * 1024);
+    HeapDestroy(heap);
+
+    // 单调模式：只申请不释放
+    Heap* arena = HeapCreate(true);
+    for (size_t i = 0; i < 10000; ++i)
+    {
+        void* ptr = HeapAlloc(arena, i % 100 + 1);
+        memset(ptr, 0xff, i % 100 + 1);
+        assert((size_t)ptr % 8 == 0);
+    }
+    HeapDestroy(arena);
+
+    cout << "heap ok" << endl;
+}
+
+struct alignas(64) CacheLineObj   // 对齐要求超过16B的类型
+{
+    char _data[64];
+};
+
+// STL容器使用ConcurrentAllocator以及std::pmr容器使用ConcurrentResource
+void TestAllocator()
+{
+    std::vector<int, ConcurrentAllocator<int>> v;
+    for (int i = 0; i < 100000; ++i)
+    {
+        v.push_back(i);
+    }
+
+    std::map<int, int, std::less<int>, ConcurrentAllocator<std::pair<const int, int>>> m;
+    std::list<int, ConcurrentAllocator<int>> l;
+    for (int i = 0; i < 10000; ++i)
+    {
+        m[i] = i;
+        l.push_back(i);
+    }
+    assert(m.size() == 10000 && l.size() == 10000);
+
+    std::vector<CacheLineObj, ConcurrentAllocator<CacheLineObj>> aligned(100);
+    assert((size_t)aligned.data() % 64 == 0);
+
+    std::pmr::vector<std::pmr::string> strs(ConcurrentResource());
+    for (int i = 0; i < 1000; ++i)
+    {
+        strs.emplace_back(std::to_string(i) + " a string long enough to skip small string optimization");
+    }
+
+    for (size_t align = 1; align <= 8192; align <<= 1)
+    {
+        void* ptr = ConcurrentResource()->allocate(100, align);
+        assert((size_t)ptr % align == 0);
+        ConcurrentResource()->deallocate(ptr, 100, align);
+    }
+
+    cout << "allocator ok" << endl;
+}
+
+// 释放掉的大块空间会被缓存，下次申请差不多大小的时候直接复用
+void TestLargeCache()
+{
+    void* p1 = ConcurrentAlloc(2 * 1024 * 1024);
+    ConcurrentFree(p1);
+
+    void* p2 = ConcurrentAlloc(2 * 1024 * 1024);
+    assert(p2 == p1);   // 同样大小直接复用
+    ConcurrentFree(p2);
+
+    void* p3 = ConcurrentAlloc(1800 * 1024);
+    assert(p3 == p1);   // 小一点的也可以复用
+    memset(p3, 0xff, 1800 * 1024);
+
+    void* p4 = ConcurrentAlloc(1024 * 1024);
+    assert(p4 != p1);
+    ConcurrentFree(p4);
+    ConcurrentTrim(0);
+    ConcurrentFree(p3);
+
+    // 之后只有小块span的申请，超时的大块span也要还给系统
+    PageCache* pc = PageCache::GetInstance();
+    size_t before = ConcurrentHeapBytes();
+    std::this_thread::sleep_for(std::chrono::milliseconds(LARGE_CACHE_IDLE_MS + 100));
+    pc->_pageMtx.lock();
+    Span* span = pc->NewSpan(1);
+    assert(pc->HeapBytes() + 1024 * 1024 < before);
+    pc->ReleaseSpanToPageCache(span);
+    pc->_pageMtx.unlock();
+
+    cout << "large cache ok" << endl;
+}
+
+void TestPageMap()
+{
+    int local = 0;
+    assert(!PageCache::GetInstance()->IsOurPointer(&local));
+
+    void* small = ConcurrentAlloc(100);
+    void* large = ConcurrentAlloc(1024 * 1024);
+    assert(PageCache::GetInstance()->IsOurPointer(small));
+    assert(PageCache::GetInstance()->IsOurPointer(large));
+
+    // 大块span中间的地址也能判断出来
+    assert(PageCache::GetInstance()->IsOurPointer((char*)large + 512 * 1024));
+
+    assert(PageCache::GetInstance()->MapObjectToSpan(small)->_objSize == 104);
+    assert(PageCache::GetInstance()->MapObjectToSpan(large)->_objSize == 1024 * 1024);
+
+    ConcurrentFree(small);
+    ConcurrentFree(large);
+
+    // 超过缓存上限的大块空间还回去之后，地址还能被后面的申请复用
+    void* huge = ConcurrentAlloc(LARGE_CACHE_BYTES + 1);
+    memset(huge, 1, LARGE_CACHE_BYTES + 1);
+    ConcurrentFree(huge);
+    void* again = ConcurrentAlloc(LARGE_CACHE_BYTES + 1);
+#if RESERVE_ADDRESS_SPACE
+    assert(again <= huge);  // 还回去的空间可能和左边的空闲span合并了，起始地址只会更低
+#endif
+    ConcurrentFree(again);
+
+    cout << "page map ok" << endl;
+}
+
+/* 预留的地址空间用完之后退回到直接向系统要页，申请不会失败
+   默认预留64GB，用 -DRESERVE_BYTES='((size_t)64 << 20)' 编译才能很快用完 */
+void TestReserveFallback()
+{
+#if RESERVE_ADDRESS_SPACE
+    if (RESERVE_BYTES > ((size_t)256 << 20))
+    {
+        cout << "reserve fallback skipped, reserved space is too large to run out" << endl;
+        return;
+    }
+
+    std::vector<char*> v;
+    for (size_t bytes = 0; bytes < 2 * RESERVE_BYTES; bytes += 1024 * 1024)
+    {
+        char* small = (char*)ConcurrentAlloc(64 * 1024);
+        char* large = (char*)ConcurrentAlloc(1024 * 1024);
+        memset(small, 1, 64 * 1024);
+        memset(large, 2, 1024 * 1024);
+        v.push_back(small);
+        v.push_back(large);
+    }
+
+    // 预留空间之外的页同样能找到span，也能判断出是内存池的指针
+    for (size_t i = 0; i < v.size(); i += 2)
+    {
+        assert(PageCache::GetInstance()->IsOurPointer(v[i]));
+        assert(PageCache::GetInstance()->IsOurPointer(v[i + 1] + 512 * 1024));
+        assert(PageCache::GetInstance()->MapObjectToSpan(v[i])->_objSize == 64 * 1024);
+        assert(ConcurrentUsableSize(v[i + 1]) >= 1024 * 1024);
+        assert(v[i][100] == 1 && v[i + 1][100] == 2);
+    }
+
+    for (char* ptr : v)
+    {
+        ConcurrentFree(ptr);
+    }
+
+    cout << "reserve fallback ok, " << v.size() / 2 << "MB of large blocks with a " << (RESERVE_BYTES >> 20) << "MB reservation" << endl;
+#endif
+}
+
+void TestCoalesce()
+{
+    PageCache* pc = PageCache::GetInstance();
+
+    // 把缓存清空，大块span还回来之后马上就能合并
+    void* big = ConcurrentAlloc(8 * 1024 * 1024);
+    ConcurrentFree(big);
+    pc->_pageMtx.lock();
+    pc->TrimLargeCache(0);
+    pc->_pageMtx.unlock();
+    assert(pc->LargestFreeRun() >= 1024);
+
+    // 切出去的几段还回来之后要重新合并成一整段，不能被128页的上限卡住
+    std::vector<void*> v;
+    for (int i = 0; i < 8; ++i)
+    {
+        v.push_back(ConcurrentAlloc(1024 * 1024));  // 正好128页
+    }
+    for (void* p : v)
+    {
+        ConcurrentFree(p);
+    }
+    pc->_pageMtx.lock();
+    pc->TrimLargeCache(0);
+    pc->_pageMtx.unlock();
+    assert(pc->LargestFreeRun() >= 1024);
+
+    cout << "coalesce ok, largest free run: " << pc->LargestFreeRun() << " pages" << endl;
+
+    void* again = ConcurrentAlloc(8 * 1024 * 1024);
+    memset(again, 1, 8 * 1024 * 1024);
+    ConcurrentFree(again);
+}
+
+void TestSpanTree()
+{
+    // 和按(页数, 页号)排序的std::set对比，页数故意挤在少数几个值上，相同页数的很多
+    std::vector<Span> spans(2000);
+    std::set<std::pair<size_t, PageID>> ref;
+    SpanTree tree;
+    for (size_t i = 0; i < spans.size(); ++i)
+    {
+        spans[i]._pageId = i * 1000 + 7;
+        spans[i]._n = 129 + (i * 7919) % 37;
+    }
+
+    std::vector<bool> in(spans.size(), false);
+    for (size_t round = 0; round < 20000; ++round)
+    {
+        size_t i = (round * 104729) % spans.size();
+        if (in[i])
+        {
+            tree.Erase(&spans[i]);
+            ref.erase({ spans[i]._n, spans[i]._pageId });
+        }
+        else
+        {
+            tree.Insert(&spans[i]);
+            ref.insert({ spans[i]._n, spans[i]._pageId });
+        }
+        in[i] = !in[i];
+
+        size_t k = 120 + round % 50;
+        Span* found = tree.LowerBound(k);
+        auto it = ref.lower_bound({ k, 0 });
+        assert((found == nullptr) == (it == ref.end()));
+        assert(found == nullptr || (found->_n == it->first && found->_pageId == it->second));
+        assert(tree.Empty() == ref.empty());
+        assert(tree.Empty() || tree.Max()->_n == ref.rbegin()->first);
+    }
+
+    // 从大到小遍历的顺序和std::set一样
+    auto it = ref.rbegin();
+    tree.ForEachDescending([&](Span* span) {
+        assert(it != ref.rend() && span->_n == it->first && span->_pageId == it->second);
+        ++it;
+        return true;
+    });
+    assert(it == ref.rend());
+
+    cout << "span tree ok" << endl;
+}
+
+void TestBackground()
+{
+    ConcurrentBackgroundStart(1);
+    assert(Maintenance::GetInstance()->Running());
+
+    size_t index = SizeClass::Index(1000);
+    size_t demand = CentralCache::GetInstance()->SpanDemand(index);
+
+    // 多个线程边申请边释放，后台线程同时在切span、合并、淘汰
+    std::vector<std::thread> vthread;
+    for (int k = 0; k < 4; ++k)
+    {
+        vthread.emplace_back([]() {
+            std::vector<void*> v;
+            for (int round = 0; round < 20; ++round)
+            {
+                for (int i = 0; i < 2000; ++i)
+                {
+                    void* ptr = ConcurrentAlloc(1000);
+                    memset(ptr, round, 1000);
+                    v.push_back(ptr);
+                }
+                for (size_t i = 0; i < v.size(); i += 2)
+                {
+                    ConcurrentFree(v[i]);
+                    v[i] = nullptr;
+                }
+                v.erase(std::remove(v.begin(), v.end(), nullptr), v.end());
+
+                void* big = ConcurrentAlloc(2 * 1024 * 1024);
+                ConcurrentFree(big);
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+            for (void* ptr : v)
+            {
+                ConcurrentFree(ptr);
+            }
+        });
+    }
+    for (auto& t : vthread)
+    {
+        t.join();
+    }
+    assert(CentralCache::GetInstance()->SpanDemand(index) > demand);
+
+    ConcurrentBackgroundStop();
+    assert(!Maintenance::GetInstance()->Running());
+
+    // 停止之后延迟的span都合并完了，还能正常申请大块空间
+    void* ptr = ConcurrentAlloc(8 * 1024 * 1024);
+    memset(ptr, 1, 8 * 1024 * 1024);
+    ConcurrentFree(ptr);
+
+    cout << "background ok" << endl;
+}
+
+void TestCalloc()
+{
+    // 先把块弄脏再还回去，calloc拿到同一块也要是0
+    char* dirty = (char*)ConcurrentAlloc(800);
+    memset(dirty, 0xff, 800);
+    ConcurrentFree(dirty);
+
+    char* p1 = (char*)ConcurrentCalloc(100, 8);
+    for (size_t i = 0; i < 800; ++i)
+    {
+        assert(p1[i] == 0);
+    }
+    ConcurrentFree(p1);
+
+    // 大块空间：缓存中复用的要清零，物理内存还给系统之后的本来就是0
+    char* big = (char*)ConcurrentAlloc(4 * 1024 * 1024);
+    memset(big, 0xff, 4 * 1024 * 1024);
+    ConcurrentFree(big);
+
+    char* p2 = (char*)ConcurrentCalloc(4, 1024 * 1024);
+    assert(p2 == big);  // 从大块缓存中复用的
+    for (size_t i = 0; i < 4 * 1024 * 1024; i += 4096)
+    {
+        assert(p2[i] == 0);
+    }
+    memset(p2, 0xff, 4 * 1024 * 1024);
+    ConcurrentFree(p2);
+
+    PageCache::GetInstance()->_pageMtx.lock();
+    PageCache::GetInstance()->TrimLargeCache(0);
+    PageCache::GetInstance()->_pageMtx.unlock();
+
+    char* p3 = (char*)ConcurrentCalloc(1024, 4096);
+    for (size_t i = 0; i < 4 * 1024 * 1024; ++i)
+    {
+        assert(p3[i] == 0);
+    }
+    ConcurrentFree(p3);
+
+    // 溢出
+    assert(ConcurrentCalloc((size_t)-1 / 2, 4) == nullptr);
+
+    void* p4 = ConcurrentCalloc(0, 8);
+    assert(p4 != nullptr);
+    ConcurrentFree(p4);
+
+    cout << "calloc ok" << endl;
+}
+
+// 申请num个size大小的块，返回各个span第一块相对span首地址的偏移量有几种
+static size_t SpanColorCount(size_t size, size_t num, std::vector<void*>& v)
+{
+    std::map<Span*, size_t> first;  // 每个span中拿到的块相对span首地址的最小偏移量
+    for (size_t i = 0; i < num; ++i)
+    {
+        char* ptr = (char*)ConcurrentAlloc(size);
+        v.push_back(ptr);
+
+        // 块都在span的范围内，地址的对齐和块大小的对齐一致
+        Span* span = PageCache::GetInstance()->MapObjectToSpan(ptr);
+        char* begin = (char*)(span->_pageId << PAGE_SHIFT);
+        assert(ptr + size <= begin + (span->_n << PAGE_SHIFT));
+        assert((size_t)ptr % std::min(size & (0 - size), (size_t)4096) == 0);
+        auto it = first.find(span);
+        if (it == first.end() || (size_t)(ptr - begin) < it->second)
+        {
+            first[span] = ptr - begin;
+        }
+    }
+
+    std::set<size_t> colors;
+    for (auto& kv : first)
+    {
+        colors.insert(kv.second);
+    }
+    return colors.size();
+}
+
+void TestSpanColor()
+{
+    /* 找一个span末尾的零头至少能错开一次的桶，默认的桶划分下是4224，
+       生成的桶划分会挑零头最小的页数，不一定是这个 */
+    size_t size = 4096;
+    do
+    {
+        size = SizeClass::RoundUp(size + 1);
+    } while ((SizeClass::NumMovePage(size) << PAGE_SHIFT) % size < std::max(CACHE_LINE, size & (0 - size)));
+    assert(size <= 64 * 1024);
+
+    // 有零头的桶在零头里挪，2的幂大小的桶空出开头的几块来挪
+    std::vector<void*> v;
+    size_t tailColors = SpanColorCount(size, std::min((size_t)2000, 32 * 1024 * 1024 / size), v);
+    size_t pow2Colors = SpanColorCount(1024, 8192, v);
+#if SPAN_COLORING
+    assert(tailColors > 1);
+    assert(pow2Colors > 1);
+#else
+    assert(tailColors == 1);
+    assert(pow2Colors == 1);
+#endif
+
+    // 着色之后带对齐要求的申请仍然满足对齐
+    for (size_t align = 16; align <= 8192; align <<= 1)
+    {
+        for (size_t bytes = 1; bytes <= 64 * 1024; bytes = bytes * 3 + 7)
+        {
+            void* ptr = ConcurrentAlignedAlloc(bytes, align);
+            assert((size_t)ptr % align == 0);
+            ConcurrentAlignedFree(ptr, bytes, align);
+        }
+    }
+
+    for (void* ptr : v)
+    {
+        ConcurrentFree(ptr);
+    }
+
+    cout << "span color ok" << endl;
+}
+
+// 构造/析构计数，构造时可以抛异常
+struct FixedObj
+{
+    static int _alive;
+
+    explicit FixedObj(int val, bool fail = false)
+        : _val(val)
+    {
+        if (fail)
+        {
+            throw std::runtime_error("FixedObj");
+        }
+        ++_alive;
+    }
+
+    ~FixedObj()
+    {
+        --_alive;
+    }
+
+    int _val;
+    char _pad[36];
+};
+int FixedObj::_alive = 0;
+
+// 编译期确定大小的申请/释放和运行期的入口可以混用
+void TestFixedSize()
+{
+    std::vector<void*> v;
+    for (int i = 0; i < 1000; ++i)
+    {
+        v.push_back(ConcurrentAlloc<1>());
+        v.push_back(ConcurrentAlloc<24>());
+        v.push_back(ConcurrentAlloc<1000>());
+        v.push_back(ConcurrentAlloc<MAX_BYTES>());
+    }
+    for (size_t i = 0; i < v.size(); i += 4)
+    {
+        assert(ConcurrentUsableSize(v[i]) == SizeClass::RoundUp(1));
+        assert(ConcurrentUsableSize(v[i + 1]) == SizeClass::RoundUp(24));
+        assert(ConcurrentUsableSize(v[i + 2]) == SizeClass::RoundUp(1000));
+        memset(v[i + 3], 0xff, MAX_BYTES);
+        ConcurrentFree<1>(v[i]);
+        ConcurrentFree(v[i + 1], 24);
+        ConcurrentFree(v[i + 2]);
+        ConcurrentFree<MAX_BYTES>(v[i + 3]);
+    }
+
+    void* large = ConcurrentAlloc<MAX_BYTES + 1>();
+    assert(ConcurrentUsableSize(large) == SizeClass::RoundUp(MAX_BYTES + 1));
+    ConcurrentFree<MAX_BYTES + 1>(large);
+
+    char* p = (char*)ConcurrentAlloc(100);
+    ConcurrentFree<100>(p);
+
+    // 新线程第一次申请走的是慢路径，要先创建tc
+    std::thread t([]() {
+        void* ptr = ConcurrentAlloc<48>();
+        ConcurrentFree<48>(ptr);
+        ConcurrentFree<64>(ConcurrentAlloc<64>());
+    });
+    t.join();
+
+    FixedObj* obj = ConcurrentNew<FixedObj>(7);
+    assert(obj->_val == 7 && FixedObj::_alive == 1);
+    ConcurrentDelete(obj);
+    assert(FixedObj::_alive == 0);
+    ConcurrentDelete((FixedObj*)nullptr);
+
+    // 构造函数抛异常，空间还回去，异常交给调用者
+    bool thrown = false;
+    try
+    {
+        ConcurrentNew<FixedObj>(1, true);
+    }
+    catch (const std::runtime_error&)
+    {
+        thrown = true;
+    }
+    assert(thrown && FixedObj::_alive == 0);
+
+    CacheLineObj* aligned = ConcurrentNew<CacheLineObj>();
+    assert((size_t)aligned % 64 == 0);
+    ConcurrentDelete(aligned);
+
+    static_assert(ConcurrentObjectSize<FixedObj>() == sizeof(FixedObj), "");
+    static_assert(SizeClass::Index(24) == 2, "");
+
+    cout << "fixed size ok" << endl;
+}
+
+void TestBatchPolicy()
+{
+    const size_t moveNum = SizeClass::NumMoveSize(16);
+
+    // 慢开始每次加1，要取几百次才到上限
+    BatchState slow;
+    size_t fetches = 0;
+    while (SlowStartBatchPolicy::FetchNum(slow, moveNum) < moveNum)
+    {
+        ++fetches;
+    }
+    assert(fetches == moveNum - 1);
+
+    // 连续取块时翻倍，十几次就到上限
+    BatchState state;
+    fetches = 0;
+    while (AdaptiveBatchPolicy::FetchNum(state, moveNum) < moveNum)
+    {
+        ++fetches;
+    }
+    assert(fetches < 16 && state._maxSize == moveNum);
+    assert(state._lowWater == moveNum / 2 && state._highWater == moveNum / 2 + moveNum);
+
+    // 连续还给cc：每次至少还一个上限，留下的越来越少，_maxSize也跟着衰减
+    size_t size = state._highWater;
+    size_t flushed = AdaptiveBatchPolicy::FlushNum(state, size, moveNum);
+    assert(flushed == moveNum && size - flushed == moveNum / 2);
+    for (int i = 0; i < 20; ++i)
+    {
+        size = state._highWater;
+        flushed = AdaptiveBatchPolicy::FlushNum(state, size, moveNum);
+        assert(flushed >= moveNum);
+    }
+    assert(state._lowWater == 0 && state._maxSize == 1);
+
+    // 取和还交替出现时只加1
+    AdaptiveBatchPolicy::FetchNum(state, moveNum);
+    assert(state._maxSize == 2);
+
+    // 实际跑一遍：一个新线程突发申请再全部释放
+    std::thread t([]() {
+        std::vector<void*> v;
+        for (int i = 0; i < 100000; ++i)
+        {
+            v.push_back(ConcurrentAlloc(16));
+        }
+        for (void* ptr : v)
+        {
+            ConcurrentFree(ptr, 16);
+        }
+    });
+    t.join();
+
+    cout << "batch policy ok" << endl;
+}
+
+// 预算回调：记下被调用的次数，s_allowOverBudget决定是否允许超出
+static size_t s_budgetCalls = 0;
+static bool s_allowOverBudget = false;
+static bool CountBudget(size_t tag, size_t /* usedBytes */, size_t requestBytes)
+{
+    assert(tag == 4 && requestBytes > 0);
+    ++s_budgetCalls;
+    return s_allowOverBudget;
+}
+
+void TestTaggedAlloc()
+{
+    // 带标签的小块空间从标签自己的span中切，统计的是span的字节数
+    std::vector<void*> v;
+    for (int i = 0; i < 1000; ++i)
+    {
+        v.push_back(ConcurrentAllocTagged(100, 1));
+    }
+    assert(ConcurrentTagBytes(1) >= 1000 * 104);
+    assert(ConcurrentTagBytes(2) == 0);
+    for (void* ptr : v)
+    {
+        assert(PageCache::GetInstance()->MapObjectToSpan(ptr)->_tag == 1);
+        ConcurrentFree(ptr);
+    }
+    v.clear();
+
+    // 块都回到cc之后span马上还给pc，标签占用的字节数回到0
+    ConcurrentThreadIdle();
+    assert(ConcurrentTagBytes(1) == 0 && ConcurrentTagPeakBytes(1) >= 1000 * 104);
+
+    // 大块空间一个span，精确记账
+    void* big = ConcurrentAllocTagged(1 << 20, 1);
+    assert(ConcurrentTagBytes(1) == 1 << 20);
+    ConcurrentFree(big);
+    assert(ConcurrentTagBytes(1) == 0);
+
+    // 作用域内的申请都记在标签下，包括编译期大小的申请和容器，作用域可以嵌套
+    {
+        ConcurrentTagScope scope(2);
+        void* p1 = ConcurrentAlloc<64>();
+        std::vector<int, ConcurrentAllocator<int>> vec(1000);
+        {
+            ConcurrentTagScope inner(3);
+            void* p2 = ConcurrentAlloc(64);
+            assert(PageCache::GetInstance()->MapObjectToSpan(p2)->_tag == 3);
+            ConcurrentFree(p2);
+        }
+        void* p3 = ConcurrentAlloc(64);
+        assert(PageCache::GetInstance()->MapObjectToSpan(p1)->_tag == 2);
+        assert(PageCache::GetInstance()->MapObjectToSpan(vec.data())->_tag == 2);
+        assert(PageCache::GetInstance()->MapObjectToSpan(p3)->_tag == 2);
+        ConcurrentFree<64>(p1);
+        ConcurrentFree(p3, 64);
+    }
+    void* p0 = ConcurrentAlloc(64);
+    assert(PageCache::GetInstance()->MapObjectToSpan(p0)->_tag == 0);
+    ConcurrentFree(p0);
+
+    // 带大小的释放让标签的块进了0号标签的tc，还给cc时会回到标签自己的cc
+    void* p4 = ConcurrentAllocTagged(48, 2);
+    ConcurrentFree(p4, 48);
+    ConcurrentThreadIdle();
+    assert(ConcurrentTagBytes(2) == 0 && ConcurrentTagBytes(3) == 0);
+
+    // 跨线程释放：块还给申请它的那个标签的tc
+    for (int i = 0; i < 1000; ++i)
+    {
+        v.push_back(ConcurrentAllocTagged(200, 3));
+    }
+    std::thread t([&v]() {
+        for (void* ptr : v)
+        {
+            ConcurrentFree(ptr);
+        }
+        ConcurrentThreadIdle();
+    });
+    t.join();
+    v.clear();
+    ConcurrentThreadIdle();
+    assert(ConcurrentTagBytes(3) == 0);
+
+    // 预算：没有回调时超出预算的申请抛出std::bad_alloc，占用不会超过预算
+    const size_t budget = 1 << 20;
+    ConcurrentSetTagBudget(4, budget);
+    bool failed = false;
+    try
+    {
+        for (int i = 0; i < 100000; ++i)
+        {
+            v.push_back(ConcurrentAllocTagged(1000, 4));
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        failed = true;
+    }
+    assert(failed && ConcurrentTagBytes(4) <= budget);
+    assert(v.size() * 1024 > budget / 2);
+
+    // 大块空间同样受预算限制
+    failed = false;
+    try
+    {
+        ConcurrentAllocTagged(budget, 4);
+    }
+    catch (const std::bad_alloc&)
+    {
+        failed = true;
+    }
+    assert(failed);
+
+    // 回调不允许时照样失败，允许时可以超出预算
+    ConcurrentSetTagBudgetHandler(CountBudget);
+    failed = false;
+    try
+    {
+        ConcurrentAllocTagged(budget, 4);
+    }
+    catch (const std::bad_alloc&)
+    {
+        failed = true;
+    }
+    assert(failed && s_budgetCalls > 0);
+
+    s_allowOverBudget = true;
+    big = ConcurrentAllocTagged(budget, 4);
+    assert(ConcurrentTagBytes(4) > budget);
+    ConcurrentFree(big);
+
+    ConcurrentSetTagBudgetHandler(nullptr);
+    ConcurrentSetTagBudget(4, 0);
+    for (void* ptr : v)
+    {
+        ConcurrentFree(ptr);
+    }
+    ConcurrentThreadIdle();
+    assert(ConcurrentTagBytes(4) == 0);
+
+    cout << "tagged alloc ok" << endl;
+}
+
+// 无锁栈的节点
+struct RetireNode
+{
+    RetireNode* _next;
+    size_t _value;
+};
+
+void TestEpochRetire()
+{
+    // 没有读者时，ConcurrentSynchronize之后退休的对象都放回了tc，接着就能被复用
+    std::set<void*> retired;
+    for (int i = 0; i < 100; ++i)
+    {
+        void* ptr = ConcurrentAlloc(40);
+        retired.insert(ptr);
+        ConcurrentRetire(ptr);
+    }
+    ConcurrentSynchronize();
+    std::vector<void*> v;
+    size_t reused = 0;
+    for (int i = 0; i < 200; ++i)
+    {
+        v.push_back(ConcurrentAlloc(40));
+        reused += retired.count(v.back());
+    }
+    assert(reused > 0);
+    for (void* ptr : v)
+    {
+        ConcurrentFree(ptr);
+    }
+    v.clear();
+    retired.clear();
+
+    // 有读者停在临界区里，epoch最多再推进一次，之后退休的对象都不会被复用
+    std::atomic<int> stage{ 0 };
+    std::thread reader([&stage]() {
+        ConcurrentEpochGuard guard;
+        stage = 1;
+        while (stage != 2)
+        {
+            std::this_thread::yield();
+        }
+    });
+    while (stage != 1)
+    {
+        std::this_thread::yield();
+    }
+    size_t epoch = EpochManager::GetInstance()->Epoch();
+    for (int i = 0; i < 1000; ++i)
+    {
+        void* ptr = ConcurrentAlloc(40);
+        retired.insert(ptr);
+        ConcurrentRetire(ptr);
+    }
+    assert(EpochManager::GetInstance()->Epoch() <= epoch + 1);
+    for (int i = 0; i < 2000; ++i)
+    {
+        v.push_back(ConcurrentAlloc(40));
+        assert(retired.count(v.back()) == 0);
+    }
+    for (void* ptr : v)
+    {
+        ConcurrentFree(ptr);
+    }
+    v.clear();
+
+    // 读者出来之后全部放回来，大块空间直接还给pc
+    stage = 2;
+    reader.join();
+    void* big = ConcurrentAllocTagged(1 << 20, 5);
+    ConcurrentRetire(big);
+    assert(ConcurrentTagBytes(5) == 1 << 20);
+    ConcurrentSynchronize();
+    assert(ConcurrentTagBytes(5) == 0);
+
+    // 线程退休之后没有调用ConcurrentSynchronize就退出了，退休的对象由别的线程回收
+    std::thread exiting([]() {
+        ConcurrentRetire(ConcurrentAllocTagged(1 << 20, 6));
+    });
+    exiting.join();
+    assert(ConcurrentTagBytes(6) == 1 << 20);
+    ConcurrentSynchronize();
+    assert(ConcurrentTagBytes(6) == 0);
+    reused = 0;
+    for (int i = 0; i < 2000; ++i)
+    {
+        v.push_back(ConcurrentAlloc(40));
+        reused += retired.count(v.back());
+    }
+    assert(reused > 0);
+    for (void* ptr : v)
+    {
+        ConcurrentFree(ptr);
+    }
+    v.clear();
+
+    // 多个线程同时对一个无锁栈push/pop，pop出来的节点退休
+    std::atomic<RetireNode*> top{ nullptr };
+    std::atomic<size_t> pushed{ 0 }, popped{ 0 };
+    std::vector<std::thread> vthread;
+    for (int k = 0; k < 4; ++k)
+    {
+        vthread.emplace_back([&]() {
+            for (int i = 0; i < 20000; ++i)
+            {
+                RetireNode* node = (RetireNode*)ConcurrentAlloc<sizeof(RetireNode)>();
+                node->_value = i;
+                node->_next = top.load();
+                while (!top.compare_exchange_weak(node->_next, node))
+                {}
+                ++pushed;
+
+                ConcurrentEpochGuard guard;
+                RetireNode* old = top.load();
+                while (old != nullptr && !top.compare_exchange_weak(old, old->_next))
+                {}
+                if (old != nullptr)
+                {
+                    assert(old->_value < 20000);
+                    ConcurrentRetire(old);
+                    ++popped;
+                }
+            }
+            ConcurrentSynchronize();
+        });
+    }
+    for (auto& t : vthread)
+    {
+        t.join();
+    }
+
+    size_t left = 0;
+    for (RetireNode* it = top.load(); it != nullptr; )
+    {
+        RetireNode* next = it->_next;
+        ConcurrentFree(it);
+        it = next;
+        ++left;
+    }
+    assert(popped + left == pushed);
+
+    cout << "epoch retire ok" << endl;
+}
+
+void TestUsableSize()
+{
+    void* p1 = ConcurrentAlloc(100);
+    assert(ConcurrentUsableSize(p1) == 104);
+    ConcurrentFree(p1);
+
+    // 大块空间返回的是整页的大小，不是申请时的大小
+    void* p2 = ConcurrentAlloc(300 * 1024 + 1);
+    assert(ConcurrentUsableSize(p2) == SizeClass::RoundUp(300 * 1024 + 1));
+    ConcurrentFree(p2);
+
+    size_t usable = 0;
+    char* p3 = (char*)ConcurrentAllocAtLeast(1000, usable);
+    assert(usable == SizeClass::RoundUp(1000) && usable == ConcurrentUsableSize(p3));
+    memset(p3, 1, usable);  // 多出来的部分可以直接用
+    ConcurrentFree(p3, usable);
+
+    // 按实际容量增长的缓冲区，扩容次数比按申请大小增长的少
+    size_t grows = 0, capacity = 0, len = 0;
+    char* buf = nullptr;
+    for (int i = 0; i < 100000; ++i)
+    {
+        if (len == capacity)
+        {
+            size_t newCapacity = 0;
+            char* newBuf = (char*)ConcurrentAllocAtLeast(capacity ? capacity * 3 / 2 : 1, newCapacity);
+            if (buf != nullptr)
+            {
+                memcpy(newBuf, buf, len);
+                ConcurrentFree(buf, capacity);
+            }
+            buf = newBuf;
+            capacity = newCapacity;
+            ++grows;
+        }
+        buf[len++] = (char)i;
+    }
+    for (size_t i = 0; i < len; ++i)
+    {
+        assert(buf[i] == (char)i);
+    }
+    ConcurrentFree(buf, capacity);
+
+    cout << "usable size ok, buffer grew " << grows << " times" << endl;
+}
+
+void TestTrim()
+{
+    std::thread t([]() {
+        std::vector<void*> v;
+        for (int i = 0; i < 20000; ++i)
+        {
+            v.push_back(ConcurrentAlloc(i % 2048 + 1));
+        }
+        for (void* ptr : v)
+        {
+            ConcurrentFree(ptr);
+        }
+
+        // 释放之后块还在tc中，空闲之后全部还回去，cc中就没有span了
+        ConcurrentThreadIdle();
+        size_t spanBytes = 0, freeBytes = 0;
+        CentralCache::GetInstance()->GetFragmentStats(spanBytes, freeBytes);
+        assert(spanBytes == 0);
+
+        // 空闲之后还能正常申请
+        void* ptr = ConcurrentAlloc(100);
+        ConcurrentFree(ptr);
+        ConcurrentThreadIdle();
+    });
+    t.join();
+
+    // span都回到了pc，物理内存可以还给系统，第二次就没有可还的了
+    size_t released = ConcurrentTrim(0);
+    assert(released > 0);
+    assert(ConcurrentTrim(0) == 0);
+
+    // 还给系统之后的页还能正常使用
+    char* ptr = (char*)ConcurrentAlloc(64 * 1024);
+    memset(ptr, 1, 64 * 1024);
+    ConcurrentFree(ptr);
+
+    cout << "trim ok, released " << (released >> 10) << " KB" << endl;
+}
+
+static void* s_oomReserve = nullptr;   // OOM回调中可以释放掉的备用内存
+static size_t s_oomCalls = 0;
+
+// OOM回调：有备用内存就释放掉让内存池再试一次，没有就放弃
+static bool TestOomHandler(size_t /* size */)
+{
+    ++s_oomCalls;
+    if (s_oomReserve == nullptr)
+    {
+        return false;
+    }
+
+    ConcurrentFree(s_oomReserve);
+    s_oomReserve = nullptr;
+    return true;
+}
+
+void TestLimits()
+{
+    size_t base = ConcurrentHeapBytes();
+    ConcurrentSetLimits(base + 32 * 1024 * 1024, base + 64 * 1024 * 1024);
+    ConcurrentSetOomHandler(TestOomHandler);
+
+    // 一直申请1MB，直到超过硬上限
+    std::vector<void*> v;
+    bool failed = false;
+    while (!failed)
+    {
+        try
+        {
+            v.push_back(ConcurrentAlloc(1024 * 1024));
+        }
+        catch (const std::bad_alloc&)
+        {
+            failed = true;
+        }
+    }
+    assert(ConcurrentHeapBytes() <= base + 64 * 1024 * 1024);
+    assert(v.size() >= 32 && s_oomCalls == 1);
+
+    // 小块空间到了硬上限同样会失败，锁都已经释放了，还能正常释放和申请
+    failed = false;
+    try
+    {
+        for (int i = 0; i < 100000; ++i)
+        {
+            v.push_back(ConcurrentAlloc(4096));
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        failed = true;
+    }
+    assert(failed);
+
+    // 回调释放了备用内存，申请可以成功
+    s_oomReserve = v.back();
+    v.pop_back();
+    ConcurrentFree(v.back());
+    v.pop_back();
+    v.push_back(ConcurrentAlloc(1024 * 1024));
+    v.push_back(ConcurrentAlloc(1024 * 1024));
+    assert(s_oomReserve == nullptr);
+
+    for (void* ptr : v)
+    {
+        ConcurrentFree(ptr);
+    }
+
+    // 超过软上限之后，下一次申请会把空闲内存还给系统
+    std::vector<void*> big;
+    for (int i = 0; i < 40; ++i)
+    {
+        big.push_back(ConcurrentAlloc(1024 * 1024));
+    }
+    for (void* ptr : big)
+    {
+        ConcurrentFree(ptr);
+    }
+    void* ptr = ConcurrentAlloc(1024 * 1024);
+    assert(ConcurrentHeapBytes() <= base + 32 * 1024 * 1024);
+    ConcurrentFree(ptr);
+
+    ConcurrentSetLimits((size_t)-1, (size_t)-1);
+    ConcurrentSetOomHandler(nullptr);
+
+    cout << "limits ok, oom handler called " << s_oomCalls << " times" << endl;
+}
+
+#ifndef _WIN32
+// 共享分配域中的链表节点，节点之间用偏移量连接
+struct SharedNode
+{
+    size_t _next;   // 下一个节点的偏移量，0表示没有
+    size_t _val;
+};
+
+// 在heap中建一条n个节点的链表，返回头结点的偏移量
+static size_t BuildSharedList(SharedHeap* heap, size_t n, size_t seed)
+{
+    size_t head = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        SharedNode* node = (SharedNode*)SharedHeapAlloc(heap, sizeof(SharedNode) + i % 200);
+        node->_next = head;
+        node->_val = i * seed;
+        head = SharedHeapOffset(heap, node);
+    }
+    return head;
+}
+
+// 遍历链表求和，顺便释放掉所有节点
+static size_t SumAndFreeSharedList(SharedHeap* heap, size_t head)
+{
+    size_t sum = 0;
+    while (head != 0)
+    {
+        SharedNode* node = (SharedNode*)SharedHeapPointer(heap, head);
+        sum += node->_val;
+        head = node->_next;
+        SharedHeapFree(heap, node);
+    }
+    return sum;
+}
+
+void TestSharedHeap()
+{
+    const size_t n = 10000;
+    const size_t expected = n * (n - 1) / 2;
+
+    SharedHeap* heap = SharedHeapCreate(64 * 1024 * 1024);
+    assert(heap != nullptr);
+
+    // 信箱：[0]父进程建的链表 [1]子进程建的链表 [2]子进程申请的大块空间 [3]计数
+    size_t* box = (size_t*)SharedHeapAlloc(heap, 4 * sizeof(size_t));
+    memset(box, 0, 4 * sizeof(size_t));
+    size_t boxOffset = SharedHeapOffset(heap, box);
+    box[0] = BuildSharedList(heap, n, 1);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {// 子进程重新映射一次，地址和父进程的不一样，只能通过偏移量访问
+        SharedHeap* mine = SharedHeapAttach(SharedHeapFd(heap));
+        size_t* b = (size_t*)SharedHeapPointer(mine, boxOffset);
+        bool ok = mine != nullptr && (void*)b != (void*)box && SumAndFreeSharedList(mine, b[0]) == expected;
+
+        // 子进程申请的对象交给父进程释放
+        b[1] = BuildSharedList(mine, n, 2);
+        b[2] = SharedHeapOffset(mine, SharedHeapAlloc(mine, 1024 * 1024));
+        _exit(ok ? 0 : 1);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(SumAndFreeSharedList(heap, box[1]) == 2 * expected);
+    size_t used = heap->UsedBytes();
+    SharedHeapFree(heap, SharedHeapPointer(heap, box[2]));
+    assert(heap->UsedBytes() == used - 1024 * 1024);
+
+    // 多个进程同时申请释放，锁是进程间共享的，不会把同一块给两个进程
+    std::atomic<size_t>* counter = (std::atomic<size_t>*)&box[3];
+    std::vector<pid_t> children;
+    for (int k = 0; k < 4; ++k)
+    {
+        pid = fork();
+        if (pid == 0)
+        {
+            std::vector<unsigned char*> v;
+            bool ok = true;
+            for (int i = 0; i < 20000; ++i)
+            {
+                size_t size = (i * 7 + k) % 4096 + 1;
+                unsigned char* ptr = (unsigned char*)SharedHeapAlloc(heap, size);
+                memset(ptr, k, size);
+                v.push_back(ptr);
+
+                if (v.size() == 64)
+                {// 写进去的内容没被别的进程改掉
+                    for (size_t j = 0; j < v.size(); ++j)
+                    {
+                        ok = ok && v[j][0] == (unsigned char)k;
+                        SharedHeapFree(heap, v[j]);
+                    }
+                    v.clear();
+                }
+                counter->fetch_add(1);
+            }
+            _exit(ok ? 0 : 1);
+        }
+        children.push_back(pid);
+    }
+    for (pid_t child : children)
+    {
+        waitpid(child, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    assert(counter->load() == 4 * 20000);
+
+    /* 子进程拿着锁、改元数据改到一半的时候被杀掉，其他进程不能一直等下去：
+       下一个拿锁的进程修复元数据之后照常申请释放 */
+    std::atomic<size_t>* ready = (std::atomic<size_t>*)&box[3];
+    ready->store(0);
+    pid = fork();
+    if (pid == 0)
+    {
+        SharedHeapHeader* header = (SharedHeapHeader*)SharedHeapPointer(heap, 0);
+        pthread_mutex_lock(&header->_mtx);
+        header->_busy.store(1);
+        ready->store(1);
+        while (true)
+        {
+            pause();
+        }
+    }
+    while (ready->load() == 0)
+    {
+        std::this_thread::yield();
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+
+    heap->UsedBytes();  // 拿锁时发现持有者死了，先修复
+    assert(((SharedHeapHeader*)SharedHeapPointer(heap, 0))->_busy.load() == 0);
+    size_t head = BuildSharedList(heap, n, 3);
+    assert(SumAndFreeSharedList(heap, head) == 3 * expected);
+
+    SharedHeapFree(heap, box);
+    SharedHeapDetach(heap);
+
+    // 有名字的共享分配域，别的进程通过名字打开
+    const char* name = "/ConcurrentMemoryPoolTest";
+    SharedHeapUnlink(name);
+    SharedHeap* named = SharedHeapCreate(1024 * 1024, name);
+    assert(named != nullptr && SharedHeapCreate(1024 * 1024, name) == nullptr);
+    SharedHeap* opened = SharedHeapOpen(name);
+    char* str = (char*)SharedHeapAlloc(named, 16);
+    strcpy(str, "shared");
+    assert(strcmp((char*)SharedHeapPointer(opened, SharedHeapOffset(named, str)), "shared") == 0);
+    SharedHeapFree(opened, SharedHeapPointer(opened, SharedHeapOffset(named, str)));
+    SharedHeapDetach(opened);
+    SharedHeapDetach(named);
+    SharedHeapUnlink(name);
+    assert(SharedHeapOpen(name) == nullptr);
+
+    // 太小建不成、空文件映射不上都返回nullptr，不抛异常，名字也不会留下来
+    assert(SharedHeapCreate(8192) == nullptr);
+    assert(SharedHeapCreate(8192, name) == nullptr);
+    assert(SharedHeapOpen(name) == nullptr);
+    named = SharedHeapCreate(1024 * 1024, name);
+    assert(named != nullptr);
+    SharedHeapDetach(named);
+    SharedHeapUnlink(name);
+
+    int emptyFd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    assert(emptyFd >= 0 && SharedHeapAttach(emptyFd) == nullptr);
+    close(emptyFd);
+    SharedHeapUnlink(name);
+
+    cout << "shared heap ok" << endl;
+}
+
+// 持久化分配域每次都映射到同一个地址，节点之间直接存指针
+struct PersistentNode
+{
+    PersistentNode* _next;
+    size_t _val;
+};
+
+static size_t SumPersistentList(PersistentNode* head)
+{
+    size_t sum = 0;
+    for (; head != nullptr; head = head->_next)
+    {
+        sum += head->_val;
+    }
+    return sum;
+}
+
+void TestPersistentHeap()
+{
+    const char* path = "/tmp/ConcurrentMemoryPoolTest.heap";
+    const size_t n = 10000;
+    unlink(path);
+
+    // 太小建不成分配域，文件不会被改大小，也不能占着默认的地址让之后的打开失败
+    SharedHeap* heap = PersistentHeapOpen(path, 8192);
+    assert(heap == nullptr);
+    struct stat st;
+    assert(stat(path, &st) == 0 && st.st_size == 0);
+
+    heap = PersistentHeapOpen(path, 64 * 1024 * 1024);
+    assert(heap != nullptr && SharedHeapRoot(heap) == nullptr);
+    assert(PersistentHeapOpen(path) == nullptr); // 同一时间只能有一个打开者
+
+    PersistentNode* head = nullptr;
+    for (size_t i = 0; i < n; ++i)
+    {
+        PersistentNode* node = (PersistentNode*)SharedHeapAlloc(heap, sizeof(PersistentNode) + i % 300);
+        node->_next = head;
+        node->_val = i;
+        head = node;
+    }
+    SharedHeapSetRoot(heap, head);
+    size_t used = heap->UsedBytes();
+    PersistentHeapClose(heap);
+
+    // 重新打开，映射到原来的地址，链表原样还在
+    heap = PersistentHeapOpen(path);
+    assert(heap != nullptr && SharedHeapRoot(heap) == head);
+    assert(SumPersistentList(head) == n * (n - 1) / 2 && heap->UsedBytes() == used);
+    PersistentHeapClose(heap);
+
+    // 子进程申请释放到一半被杀掉，父进程重新打开时修复元数据
+    for (int k = 0; k < 5; ++k)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            SharedHeap* mine = PersistentHeapOpen(path);
+            if (mine == nullptr)
+            {
+                _exit(1);
+            }
+            std::vector<void*> v;
+            for (size_t i = 0;; ++i)
+            {
+                // 小块空间和单独占一段的大块空间都有
+                size_t size = i % 100 == 0 ? 300 * 1024 : (i * 13 + k) % 4096 + 1;
+                v.push_back(SharedHeapAlloc(mine, size));
+                if (v.size() == 32)
+                {
+                    for (void* ptr : v)
+                    {
+                        SharedHeapFree(mine, ptr);
+                    }
+                    v.clear();
+                }
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20 + k * 10));
+        kill(pid, SIGKILL);
+        int status = 0;
+        waitpid(pid, &status, 0);
+        assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+
+        heap = PersistentHeapOpen(path);
+        assert(heap != nullptr && SharedHeapRoot(heap) == head);
+        assert(SumPersistentList(head) == n * (n - 1) / 2);
+
+        // 修复之后还能正常申请释放，不会和链表节点重叠
+        std::vector<char*> v;
+        for (int i = 0; i < 1000; ++i)
+        {
+            char* ptr = (char*)SharedHeapAlloc(heap, i % 5000 + 1);
+            memset(ptr, 0xff, i % 5000 + 1);
+            v.push_back(ptr);
+        }
+        assert(SumPersistentList(head) == n * (n - 1) / 2);
+        for (char* ptr : v)
+        {
+            SharedHeapFree(heap, ptr);
+        }
+        PersistentHeapClose(heap);
+    }
+
+    /* 段已经标记成使用中、还没交出去的时候崩溃：直接改区域头部和页表造出这种状态，
+       重新打开时这一段要还回去，不能当成使用中的泄漏掉 */
+    for (SharedPageState state : { SHARED_PAGE_LARGE, SHARED_PAGE_SMALL })
+    {
+        heap = PersistentHeapOpen(path);
+        assert(heap != nullptr);
+        size_t before = heap->UsedBytes();
+        char* ptr = (char*)SharedHeapAlloc(heap, 300 * 1024);
+        assert(heap->UsedBytes() > before);
+
+        SharedHeapHeader* header = (SharedHeapHeader*)SharedHeapPointer(heap, 0);
+        SharedPage* table = (SharedPage*)SharedHeapPointer(heap, header->_tableOffset);
+        size_t first = SharedHeapOffset(heap, ptr) >> PAGE_SHIFT;
+        table[first]._state = table[first + table[first]._n - 1]._state = state;
+        table[first]._index = 0;    // 小块空间的页还没挂到0号桶上
+        header->_pending = first;
+        header->_busy.store(1);
+        PersistentHeapClose(heap);
+
+        heap = PersistentHeapOpen(path);
+        assert(heap != nullptr && heap->UsedBytes() == before);
+        assert(SumPersistentList(head) == n * (n - 1) / 2);
+        PersistentHeapClose(heap);
+    }
+    unlink(path);
+
+    cout << "persistent heap ok" << endl;
+}
+#endif
+
+void TestAdaptiveLock()
+{
+    AdaptiveLock lock;
+    size_t count = 0;   // 只在锁内修改
+
+    std::vector<std::thread> vthread;
+    for (int k = 0; k < 8; ++k)
+    {
+        vthread.emplace_back([&]() {
+            for (int i = 0; i < 100000; ++i)
+            {
+                std::lock_guard<AdaptiveLock> guard(lock);
+                ++count;
+            }
+        });
+    }
+    for (auto& t : vthread)
+    {
+        t.join();
+    }
+    assert(count == 8 * 100000);
+
+    assert(lock.try_lock());
+    assert(!lock.try_lock());
+    lock.unlock();
+
+    cout << "adaptive lock ok" << endl;
+}
+
+#if LOCK_STATS
+void TestLockStats()
+{
+    ResetLockStats();
+
+    std::vector<std::thread> vthread;
+    for (int k = 0; k < 4; ++k)
+    {
+        vthread.emplace_back([]() {
+            std::vector<void*> v;
+            for (int i = 0; i < 10000; ++i)
+            {
+                v.push_back(ConcurrentAlloc(i % 4096 + 1));
+            }
+            for (void* ptr : v)
+            {
+                ConcurrentFree(ptr);
+            }
+        });
+    }
+    for (auto& t : vthread)
+    {
+        t.join();
+    }
+
+    LockStats& page = GetLockStats(LOCK_PAGE);
+    LockStats& bucket = GetLockStats(LOCK_BUCKET);
+    assert(page._acquires > 0 && bucket._acquires > 0);
+    assert(page._contended <= page._acquires && bucket._contended <= bucket._acquires);
+
+    size_t holds = 0;
+    for (size_t i = 0; i < LOCK_HIST_NUM; ++i)
+    {
+        holds += bucket._holdHist[i];
+    }
+    assert(holds == bucket._acquires);
+
+    PrintLockStats();
+    cout << "lock stats ok" << endl;
+}
+#endif
+
 int main()
 {
     // AllocTest(); 
@@ -146,6 +1716,34 @@ int main()
 
     // BigAlloc();
 
+    // TestRemoteFree();
+    // TestRemoteFreeAfterExit();
+    // TestHeap();
+    // TestAllocator();
+    // TestLargeCache();
+    // TestPageMap();
+    // TestReserveFallback();
+    // TestCoalesce();
+    // TestSpanTree();
+    // TestBackground();
+    // TestCalloc();
+    // TestUsableSize();
+    // TestSpanColor();
+    // TestFixedSize();
+    // TestBatchPolicy();
+    // TestTaggedAlloc();
+    // TestEpochRetire();
+    // TestAdaptiveLock();
+    // TestTrim();
+    // TestLimits();
+#ifndef _WIN32
+    // TestSharedHeap();
+    // TestPersistentHeap();
+#endif
+#if LOCK_STATS
+    // TestLockStats();
+#endif
+
 
 
     return 0;
@@ -3,7 +3,20 @@
    2. 申请ntimes * rounds 次不同的块大小的空间 
 */
 
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <fstream>
+#include <condition_variable>
+#include <deque>
+#ifdef __linux__
+    #include <unistd.h>
+#endif
+#include <map>
+#include <set>
 #include "ConcurrentAlloc.h"
+#include "ConcurrentAllocator.h"
 
 /*
     ntimes: 一轮申请和释放内存的次数
@@ -114,18 +127,946 @@ void BenchmarkConcurrentMalloc(size_t ntimes, size_t nworks, size_t rounds)
         nworks, nworks * rounds * ntimes, malloc_costtime.load() + free_costtime.load());
 }
 
+// 当前进程的常驻内存(RSS)大小，单位KB，只在Linux下通过/proc获取
+size_t GetRSSKB()
+{
+#ifdef __linux__
+    size_t vmPages = 0, rssPages = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> vmPages >> rssPages;
+    return rssPages * (sysconf(_SC_PAGESIZE) >> 10);
+#else
+    return 0;
+#endif
+}
+
+/* 反复随机申请释放不同大小的块（churn），每轮只留下少量存活对象，
+   最后统计cc中span的空闲比例（外碎片）和进程RSS
+*/
+void BenchmarkChurnFragmentation(size_t ntimes, size_t rounds)
+{
+    std::mt19937 rng(12345);
+    std::vector<void*> live;    // 长期存活的对象
+    std::vector<void*> v;
+    v.reserve(ntimes);
+
+    size_t begin = clock();
+    for (size_t j = 0; j < rounds; ++j)
+    {
+        for (size_t i = 0; i < ntimes; ++i)
+        {
+            v.push_back(ConcurrentAlloc(rng() % 1024 + 1));
+        }
+
+        // 打乱顺序后释放15/16，剩下的作为长期存活对象
+        std::shuffle(v.begin(), v.end(), rng);
+        for (size_t i = 0; i < v.size(); ++i)
+        {
+            if (i % 16 == 0)
+            {
+                live.push_back(v[i]);
+            }
+            else
+            {
+                ConcurrentFree(v[i]);
+            }
+        }
+        v.clear();
+    }
+    size_t end = clock();
+
+    size_t spanBytes = 0, freeBytes = 0;
+    CentralCache::GetInstance()->GetFragmentStats(spanBytes, freeBytes);
+
+    printf("churn %zu轮次，每轮次%zu次：花费：%lu ms，存活对象%zu个\n",
+        rounds, ntimes, end - begin, live.size());
+    printf("cc中span总计%zu KB，空闲%zu KB，外碎片率%.2f%%，RSS：%zu KB\n",
+        spanBytes >> 10, freeBytes >> 10,
+        spanBytes ? 100.0 * freeBytes / spanBytes : 0.0, GetRSSKB());
+
+    for (auto e : live)
+    {
+        ConcurrentFree(e);
+    }
+}
+
+/* 生产者线程申请、消费者线程释放（跨线程释放）
+   allocFunc/freeFunc分别是申请和释放函数，用来对比malloc和ConcurrentAlloc
+*/
+template<class AllocFunc, class FreeFunc>
+size_t CrossThreadFree(size_t ntimes, size_t rounds, AllocFunc allocFunc, FreeFunc freeFunc)
+{
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::vector<void*>> batches;   // 生产者交给消费者的一批批块
+    bool done = false;
+
+    size_t begin = clock();
+    std::thread consumer([&]() {
+        while (true)
+        {
+            std::vector<void*> v;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [&]() { return done || !batches.empty(); });
+                if (batches.empty())
+                {
+                    break;
+                }
+                v.swap(batches.front());
+                batches.pop_front();
+            }
+
+            for (auto e : v)
+            {
+                freeFunc(e);
+            }
+        }
+    });
+
+    std::thread producer([&]() {
+        for (size_t j = 0; j < rounds; ++j)
+        {
+            std::vector<void*> v;
+            v.reserve(ntimes);
+            for (size_t i = 0; i < ntimes; ++i)
+            {
+                v.push_back(allocFunc(16));
+            }
+
+            std::lock_guard<std::mutex> lock(mtx);
+            batches.push_back(std::move(v));
+            cv.notify_one();
+        }
+
+        std::lock_guard<std::mutex> lock(mtx);
+        done = true;
+        cv.notify_one();
+    });
+
+    producer.join();
+    consumer.join();
+
+    return clock() - begin;
+}
+
+void BenchmarkCrossThreadFree(size_t ntimes, size_t rounds)
+{
+    size_t mallocTime = CrossThreadFree(ntimes, rounds,
+        [](size_t size) { return malloc(size); }, [](void* ptr) { free(ptr); });
+    size_t concurrentTime = CrossThreadFree(ntimes, rounds,
+        [](size_t size) { return ConcurrentAlloc(size); }, [](void* ptr) { ConcurrentFree(ptr); });
+
+    printf("生产者申请、消费者释放%zu轮次，每轮次%zu次：malloc花费：%lu ms，concurrent alloc花费：%lu ms\n",
+        rounds, ntimes, mallocTime, concurrentTime);
+}
+
+/* 模拟一个个独立的请求：每个请求申请ntimes个小对象，请求结束时全部释放
+   对比逐个ConcurrentFree、Heap整体销毁以及单调模式的Heap
+*/
+void BenchmarkHeapRequests(size_t ntimes, size_t rounds)
+{
+    std::vector<void*> v;
+    v.reserve(ntimes);
+
+    size_t begin1 = clock();
+    for (size_t j = 0; j < rounds; ++j)
+    {
+        for (size_t i = 0; i < ntimes; ++i)
+        {
+            v.push_back(ConcurrentAlloc(i % 256 + 1));
+        }
+        for (size_t i = 0; i < ntimes; ++i)
+        {
+            ConcurrentFree(v[i]);
+        }
+        v.clear();
+    }
+    size_t end1 = clock();
+
+    size_t begin2 = clock();
+    for (size_t j = 0; j < rounds; ++j)
+    {
+        Heap* heap = HeapCreate();
+        for (size_t i = 0; i < ntimes; ++i)
+        {
+            v.push_back(HeapAlloc(heap, i % 256 + 1));
+        }
+        HeapDestroy(heap);
+        v.clear();
+    }
+    size_t end2 = clock();
+
+    size_t begin3 = clock();
+    for (size_t j = 0; j < rounds; ++j)
+    {
+        Heap* arena = HeapCreate(true);
+        for (size_t i = 0; i < ntimes; ++i)
+        {
+            v.push_back(HeapAlloc(arena, i % 256 + 1));
+        }
+        HeapDestroy(arena);
+        v.clear();
+    }
+    size_t end3 = clock();
+
+    printf("%zu个请求，每个请求申请%zu次：逐个ConcurrentFree花费：%lu ms，HeapDestroy花费：%lu ms，单调Heap花费：%lu ms\n",
+        rounds, ntimes, end1 - begin1, end2 - begin2, end3 - begin3);
+}
+
+// map插入删除的churn：每轮插入ntimes个随机key，再全部删除
+template<class Map>
+size_t MapChurn(Map& m, size_t ntimes, size_t rounds)
+{
+    std::mt19937 rng(12345);
+    size_t begin = clock();
+    for (size_t j = 0; j < rounds; ++j)
+    {
+        for (size_t i = 0; i < ntimes; ++i)
+        {
+            m[rng()] = i;
+        }
+        while (!m.empty())
+        {
+            m.erase(m.begin());
+        }
+    }
+    return clock() - begin;
+}
+
+/* 节点型容器的对比：std::allocator、ConcurrentAllocator和std::pmr::map + ConcurrentResource
+   nworks个线程各自操作自己的map
+*/
+void BenchmarkNodeContainer(size_t ntimes, size_t rounds, size_t nworks)
+{
+    std::atomic<size_t> stdTime(0), poolTime(0), pmrTime(0);
+    std::vector<std::thread> vthread(nworks);
+
+    for (size_t k = 0; k < nworks; ++k)
+    {
+        vthread[k] = std::thread([&]() {
+            std::map<size_t, size_t> m1;
+            stdTime += MapChurn(m1, ntimes, rounds);
+
+            std::map<size_t, size_t, std::less<size_t>,
+                ConcurrentAllocator<std::pair<const size_t, size_t>>> m2;
+            poolTime += MapChurn(m2, ntimes, rounds);
+
+            std::pmr::map<size_t, size_t> m3(ConcurrentResource());
+            pmrTime += MapChurn(m3, ntimes, rounds);
+        });
+    }
+
+    for (auto& t : vthread)
+    {
+        t.join();
+    }
+
+    printf("%zu个线程map插入删除%zu轮次，每轮次%zu个节点：std::allocator花费：%lu ms，ConcurrentAllocator花费：%lu ms，pmr花费：%lu ms\n",
+        nworks, rounds, ntimes, stdTime.load(), poolTime.load(), pmrTime.load());
+}
+
+// 反复申请释放1~16MB的大块空间，对比malloc和ConcurrentAlloc
+void BenchmarkLargeAlloc(size_t ntimes)
+{
+    std::mt19937 rng(12345);
+    std::vector<size_t> sizes(ntimes);
+    for (auto& e : sizes)
+    {
+        e = (rng() % 16 + 1) * 1024 * 1024;
+    }
+
+    size_t begin1 = clock();
+    for (size_t i = 0; i < ntimes; ++i)
+    {
+        char* ptr = (char*)malloc(sizes[i]);
+        ptr[0] = ptr[sizes[i] - 1] = 1;     // 碰一下首尾，真正触发缺页
+        free(ptr);
+    }
+    size_t end1 = clock();
+
+    size_t begin2 = clock();
+    for (size_t i = 0; i < ntimes; ++i)
+    {
+        char* ptr = (char*)ConcurrentAlloc(sizes[i]);
+        ptr[0] = ptr[sizes[i] - 1] = 1;
+        ConcurrentFree(ptr);
+    }
+    size_t end2 = clock();
+
+    printf("申请释放1~16MB大块空间%zu次：malloc花费：%lu ms，concurrent alloc花费：%lu ms\n",
+        ntimes, end1 - begin1, end2 - begin2);
+}
+
+/* 多线程申请的单次延迟分布，每轮每个线程申请ntimes个1B~8KB的块再释放一半
+   background为true时打开后台维护线程，对比尾延迟
+*/
+void BenchmarkAllocLatency(size_t ntimes, size_t rounds, size_t nworks, bool background)
+{
+    if (background)
+    {
+        ConcurrentBackgroundStart(1);
+    }
+
+    std::vector<std::vector<uint32_t>> latency(nworks);  // 每次申请花费的ns
+    std::vector<std::thread> vthread(nworks);
+    for (size_t k = 0; k < nworks; ++k)
+    {
+        vthread[k] = std::thread([&, k]() {
+            std::mt19937 rng(k);
+            std::vector<void*> v, live;
+            v.reserve(ntimes);
+            live.reserve(ntimes * rounds);
+            latency[k].reserve(ntimes * rounds);
+
+            for (size_t j = 0; j < rounds; ++j)
+            {
+                for (size_t i = 0; i < ntimes; ++i)
+                {
+                    size_t size = rng() % 8192 + 1;
+                    auto begin = std::chrono::steady_clock::now();
+                    void* ptr = ConcurrentAlloc(size);
+                    auto end = std::chrono::steady_clock::now();
+
+                    latency[k].push_back((uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+                    v.push_back(ptr);
+                }
+                // 释放一半，另一半一直存活，工作集不断增长，一直有新的span要切
+                for (size_t i = 0; i < v.size(); ++i)
+                {
+                    if (i % 2)
+                    {
+                        ConcurrentFree(v[i]);
+                    }
+                    else
+                    {
+                        live.push_back(v[i]);
+                    }
+                }
+                v.clear();
+
+                // 两轮之间留一点空闲，后台线程可以在这个时候干活
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+
+            for (void* ptr : live)
+            {
+                ConcurrentFree(ptr);
+            }
+        });
+    }
+    for (auto& t : vthread)
+    {
+        t.join();
+    }
+
+    if (background)
+    {
+        ConcurrentBackgroundStop();
+    }
+
+    std::vector<uint32_t> all;
+    for (auto& e : latency)
+    {
+        all.insert(all.end(), e.begin(), e.end());
+    }
+    std::sort(all.begin(), all.end());
+
+    printf("%zu个线程申请%zu次，后台线程%s：p50 %u ns，p99 %u ns，p999 %u ns，max %u ns\n",
+        nworks, all.size(), background ? "开" : "关",
+        all[all.size() / 2], all[all.size() * 99 / 100], all[all.size() * 999 / 1000], all.back());
+}
+/* 每轮申请batch个块再释放，中间穿插扫一遍大数组把缓存冲掉，
+   只统计申请的时间，看自由链表冷的时候的申请速度
+*/
+template<class AllocFunc, class FreeFunc>
+size_t ColdFreeList(size_t batch, size_t rounds, AllocFunc allocFunc, FreeFunc freeFunc)
+{
+    std::vector<char> junk(32 * 1024 * 1024);
+    std::vector<void*> v(batch);
+    size_t total = 0;
+
+    for (size_t j = 0; j < rounds; ++j)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < batch; ++i)
+        {
+            v[i] = allocFunc(64);
+        }
+        auto end = std::chrono::steady_clock::now();
+        total += std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+
+        for (size_t i = 0; i < batch; ++i)
+        {
+            *(char*)v[i] = (char)i;
+            freeFunc(v[i]);
+        }
+
+        // 冲缓存
+        for (size_t i = 0; i < junk.size(); i += 64)
+        {
+            junk[i] += (char)j;
+        }
+    }
+
+    return total / (batch * rounds);
+}
+
+void BenchmarkColdFreeList(size_t batch, size_t rounds)
+{
+    size_t t1 = ColdFreeList(batch, rounds, malloc, free);
+    size_t t2 = ColdFreeList(batch, rounds, [](size_t size) { return ConcurrentAlloc(size); },
+        [](void* ptr) { ConcurrentFree(ptr, 64); });
+
+    printf("缓存冲掉之后每轮申请%zu块，%zu轮次：malloc平均每次%zu ns，concurrent alloc平均每次%zu ns\n",
+        batch, rounds, t1, t2);
+}
+/* 每轮申请ntimes张bytes大小的清零表，每页只写一个字节，再全部释放
+   对比calloc、ConcurrentAlloc + memset和ConcurrentCalloc
+*/
+void BenchmarkCalloc(size_t ntimes, size_t rounds, size_t bytes)
+{
+    std::vector<char*> v(ntimes);
+    auto run = [&](auto allocFunc, auto freeFunc) {
+        size_t begin = clock();
+        for (size_t j = 0; j < rounds; ++j)
+        {
+            for (size_t i = 0; i < ntimes; ++i)
+            {
+                v[i] = (char*)allocFunc();
+                for (size_t k = 0; k < bytes; k += 4096)
+                {
+                    v[i][k] += 1;
+                }
+            }
+            for (size_t i = 0; i < ntimes; ++i)
+            {
+                freeFunc(v[i]);
+            }
+        }
+        return clock() - begin;
+    };
+
+    size_t t1 = run([&]() { return calloc(1, bytes); }, free);
+    size_t t2 = run([&]() { void* ptr = ConcurrentAlloc(bytes); memset(ptr, 0, bytes); return ptr; },
+        [](void* ptr) { ConcurrentFree(ptr); });
+    size_t t3 = run([&]() { return ConcurrentCalloc(1, bytes); }, [](void* ptr) { ConcurrentFree(ptr); });
+
+    printf("%zu轮次，每轮次申请%zu张%zu KB的清零表：calloc花费：%lu ms，alloc + memset花费：%lu ms，concurrent calloc花费：%lu ms\n",
+        rounds, ntimes, bytes >> 10, t1, t2, t3);
+}
+/* 多个线程突发申请之后进入空闲，依次调用ConcurrentThreadIdle和ConcurrentTrim，看RSS的变化
+*/
+void BenchmarkIdleTrim(size_t ntimes, size_t nworks)
+{
+    size_t rssBegin = GetRSSKB();
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    size_t done = 0;        // 完成突发的线程数
+    bool idle = false;      // 通知线程进入空闲
+
+    std::vector<std::thread> vthread(nworks);
+    for (size_t k = 0; k < nworks; ++k)
+    {
+        vthread[k] = std::thread([&, k]() {
+            std::mt19937 rng(k);
+            std::vector<void*> v(ntimes);
+            for (auto& e : v)
+            {
+                e = ConcurrentAlloc(rng() % 4096 + 1);
+                memset(e, 1, 8);
+            }
+            for (auto e : v)
+            {
+                ConcurrentFree(e);
+            }
+
+            std::unique_lock<std::mutex> lock(mtx);
+            ++done;
+            cv.notify_all();
+            cv.wait(lock, [&]() { return idle; });
+            lock.unlock();
+
+            ConcurrentThreadIdle();
+        });
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&]() { return done == nworks; });
+    }
+    size_t rssBurst = GetRSSKB();
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        idle = true;
+    }
+    cv.notify_all();
+    for (auto& t : vthread)
+    {
+        t.join();
+    }
+    size_t rssIdle = GetRSSKB();
+
+    size_t released = ConcurrentTrim(0);
+    size_t rssTrim = GetRSSKB();
+
+    printf("%zu个线程各申请%zu次后释放：RSS开始%zu KB，突发之后%zu KB，ThreadIdle之后%zu KB，Trim之后%zu KB（还给系统%zu KB）\n",
+        nworks, ntimes, rssBegin, rssBurst, rssIdle, rssTrim, released >> 10);
+}
+
+#define LOCK_NAME_STR(x) LOCK_NAME_STR2(x)
+#define LOCK_NAME_STR2(x) #x
+
+/* 锁的扩展性：1~64个线程，每个线程申请ntimes次1B~32KB的块，同时最多存活64块
+   大块的批量数很小，会频繁地访问cc和pc，用 -DALLOC_LOCK=std::mutex 编译一份做对比
+*/
+void BenchmarkLockScaling(size_t ntimes)
+{
+    for (size_t nworks = 1; nworks <= 64; nworks *= 2)
+    {
+        std::vector<std::thread> vthread(nworks);
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t k = 0; k < nworks; ++k)
+        {
+            vthread[k] = std::thread([&, k]() {
+                std::mt19937 rng(k);
+                void* window[64] = { nullptr };
+                for (size_t i = 0; i < ntimes; ++i)
+                {
+                    void*& slot = window[i % 64];
+                    if (slot != nullptr)
+                    {
+                        ConcurrentFree(slot);
+                    }
+                    slot = ConcurrentAlloc(rng() % (32 * 1024) + 1);
+                }
+                for (void* ptr : window)
+                {
+                    if (ptr != nullptr)
+                    {
+                        ConcurrentFree(ptr);
+                    }
+                }
+            });
+        }
+        for (auto& t : vthread)
+        {
+            t.join();
+        }
+        auto end = std::chrono::steady_clock::now();
+        size_t us = (size_t)std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+
+        printf("%s，%zu个线程，每个线程申请释放%zu次：花费：%zu us，平均每次%.1f ns\n",
+            LOCK_NAME_STR(ALLOC_LOCK), nworks, ntimes, us, 1000.0 * us / (nworks * ntimes));
+    }
+}
+
+/* 启动开销：进程中第一次申请小块/大块空间、新线程第一次申请各要多久，以及此时的RSS
+   cc和pc的单例是编译期初始化的，main之前不会碰内存池，要放在main的最前面跑才有意义
+*/
+void BenchmarkStartup()
+{
+    size_t rssBegin = GetRSSKB();
+
+    auto t0 = std::chrono::steady_clock::now();
+    void* small = ConcurrentAlloc(16);
+    auto t1 = std::chrono::steady_clock::now();
+    void* large = ConcurrentAlloc(1024 * 1024);
+    auto t2 = std::chrono::steady_clock::now();
+
+    size_t threadNs = 0;
+    std::thread t([&]() {
+        auto begin = std::chrono::steady_clock::now();
+        void* ptr = ConcurrentAlloc(16);
+        threadNs = (size_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - begin).count();
+        ConcurrentFree(ptr);
+    });
+    t.join();
+
+    printf("sizeof(PageCache)：%zu KB，sizeof(CentralCache)：%zu KB\n",
+        sizeof(PageCache) / 1024, sizeof(CentralCache) / 1024);
+    printf("第一次申请16B：%zu ns，第一次申请1MB：%zu ns，新线程第一次申请16B：%zu ns\n",
+        (size_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count(),
+        (size_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count(), threadNs);
+    printf("RSS：启动时%zu KB，第一次申请之后%zu KB\n", rssBegin, GetRSSKB());
+
+    ConcurrentFree(small);
+    ConcurrentFree(large);
+}
+
+#define BATCH_POLICY_STR(x) LOCK_NAME_STR(x)
+
+/* 突发负载下tc和cc之间的批量移动：每轮新起nworks个线程，每个线程依次对几种大小各做一次突发，
+   一次突发申请burst块再全部释放，另外再做一段申请释放交替的滑动窗口负载
+   -DLOCK_STATS=1 编译时统计每百万次申请加了多少次cc的桶锁，-DBATCH_POLICY=SlowStartBatchPolicy 对比原来的慢开始 */
+void BenchmarkBatchPolicy(size_t burst, size_t rounds, size_t nworks)
+{
+    const size_t sizes[] = { 16, 48, 128, 1024 };
+    std::atomic<size_t> allocs{ 0 };
+#if LOCK_STATS
+    ResetLockStats();
+#endif
+
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        std::vector<std::thread> vthread;
+        for (size_t k = 0; k < nworks; ++k)
+        {
+            vthread.emplace_back([&, k]() {
+                std::vector<void*> v;
+                v.reserve(burst);
+                for (size_t size : sizes)
+                {
+                    for (size_t i = 0; i < burst; ++i)
+                    {
+                        v.push_back(ConcurrentAlloc(size));
+                    }
+                    for (void* ptr : v)
+                    {
+                        ConcurrentFree(ptr, size);
+                    }
+                    v.clear();
+                }
+
+                // 窗口里保持最多1000块，随机申请或者释放
+                std::mt19937 rng((unsigned)k);
+                for (size_t i = 0; i < burst; ++i)
+                {
+                    if (v.empty() || (v.size() < 1000 && rng() % 2 == 0))
+                    {
+                        v.push_back(ConcurrentAlloc(64));
+                    }
+                    else
+                    {
+                        ConcurrentFree(v.back(), 64);
+                        v.pop_back();
+                    }
+                }
+                for (void* ptr : v)
+                {
+                    ConcurrentFree(ptr, 64);
+                }
+                allocs += burst * (sizeof(sizes) / sizeof(sizes[0])) + burst / 2;
+            });
+        }
+        for (auto& t : vthread)
+        {
+            t.join();
+        }
+    }
+    double ms = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - begin).count() / 1000.0;
+
+    printf("%s：%zu轮次，每轮%zu个新线程，每次突发%zu块：总耗时%.1f ms",
+        BATCH_POLICY_STR(BATCH_POLICY), rounds, nworks, burst, ms);
+#if LOCK_STATS
+    printf("，每百万次申请加cc桶锁%.0f次", GetLockStats(LOCK_BUCKET)._acquires.load() * 1e6 / allocs.load());
+#endif
+    printf("\n");
+}
+
+// 编译期确定大小的入口 vs 运行期传大小的入口，单线程反复申请释放ntimes个24B的对象
+struct FixedNode
+{
+    FixedNode* _next;
+    size_t _key;
+    size_t _val;
+};
+
+void BenchmarkFixedSize(size_t ntimes, size_t rounds)
+{
+    std::vector<void*> v(ntimes);
+    auto run = [&](auto allocFunc, auto freeFunc) {
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t j = 0; j < rounds; ++j)
+        {
+            for (size_t i = 0; i < ntimes; ++i)
+            {
+                v[i] = allocFunc();
+            }
+            for (size_t i = 0; i < ntimes; ++i)
+            {
+                freeFunc(v[i]);
+            }
+        }
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - begin).count() / (ntimes * rounds);
+    };
+
+    // 大小放在volatile变量里，模拟编译器看不到大小的调用
+    volatile size_t size = sizeof(FixedNode);
+    double t1 = run([&]() { return ConcurrentAlloc(size); }, [&](void* ptr) { ConcurrentFree(ptr, size); });
+    double t2 = run([]() { return ConcurrentAlloc<sizeof(FixedNode)>(); },
+        [](void* ptr) { ConcurrentFree<sizeof(FixedNode)>(ptr); });
+    double t3 = run([]() { return ConcurrentNew<FixedNode>(); },
+        [](void* ptr) { ConcurrentDelete((FixedNode*)ptr); });
+
+    printf("%zu轮次，每轮次申请释放%zu个%zuB的对象：ConcurrentAlloc(size) %.2f ns，ConcurrentAlloc<N> %.2f ns，ConcurrentNew<T> %.2f ns\n",
+        rounds, ntimes, sizeof(FixedNode), t1, t2, t3);
+}
+
+/* 标签统计的开销：nworks个线程各自申请释放ntimes个大小不同的对象，
+   没有标签 vs 整个线程在标签作用域里 vs 每次都调用ConcurrentAllocTagged，每个线程用不同的标签 */
+void BenchmarkTaggedAlloc(size_t ntimes, size_t rounds, size_t nworks)
+{
+    auto run = [&](bool scoped, auto allocFunc) {
+        std::vector<std::thread> vthread;
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t k = 0; k < nworks; ++k)
+        {
+            vthread.emplace_back([&, k]() {
+                size_t tag = k % (TAG_NUM - 1) + 1;
+                ConcurrentTagScope scope(scoped ? tag : 0);
+                std::vector<void*> v(ntimes);
+                for (size_t j = 0; j < rounds; ++j)
+                {
+                    for (size_t i = 0; i < ntimes; ++i)
+                    {
+                        v[i] = allocFunc((i % 64 + 1) * 16, tag);
+                    }
+                    for (size_t i = 0; i < ntimes; ++i)
+                    {
+                        ConcurrentFree(v[i]);
+                    }
+                }
+                ConcurrentThreadIdle();
+            });
+        }
+        for (auto& t : vthread)
+        {
+            t.join();
+        }
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - begin).count() / (ntimes * rounds * nworks);
+    };
+
+    double t1 = run(false, [](size_t size, size_t) { return ConcurrentAlloc(size); });
+    double t2 = run(true, [](size_t size, size_t) { return ConcurrentAlloc(size); });
+    double t3 = run(false, [](size_t size, size_t tag) { return ConcurrentAllocTagged(size, tag); });
+
+    printf("%zu个线程，%zu轮次，每轮次申请释放%zu个16~1024B的对象：没有标签 %.2f ns，标签作用域 %.2f ns，ConcurrentAllocTagged %.2f ns\n",
+        nworks, rounds, ntimes, t1, t2, t3);
+}
+
+/* 无锁数据结构摘下来的节点怎么回收：nworks个线程，每次在读者临界区里申请一个节点再回收一个
+   马上ConcurrentFree(不安全，只是下限) vs ConcurrentRetire vs 自己攒RETIRE_BATCH_NUM个再逐个ConcurrentFree */
+void BenchmarkRetire(size_t ntimes, size_t rounds, size_t nworks)
+{
+    auto run = [&](auto freeFunc) {
+        std::vector<std::thread> vthread;
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t k = 0; k < nworks; ++k)
+        {
+            vthread.emplace_back([&]() {
+                std::vector<void*> buffer;
+                for (size_t j = 0; j < rounds; ++j)
+                {
+                    for (size_t i = 0; i < ntimes; ++i)
+                    {
+                        ConcurrentEpochGuard guard;
+                        freeFunc(ConcurrentAlloc<sizeof(FixedNode)>(), buffer);
+                    }
+                }
+                for (void* ptr : buffer)
+                {
+                    ConcurrentFree(ptr);
+                }
+                ConcurrentSynchronize();
+            });
+        }
+        for (auto& t : vthread)
+        {
+            t.join();
+        }
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - begin).count() / (ntimes * rounds * nworks);
+    };
+
+    double t1 = run([](void* ptr, std::vector<void*>&) { ConcurrentFree<sizeof(FixedNode)>(ptr); });
+    double t2 = run([](void* ptr, std::vector<void*>&) { ConcurrentRetire(ptr); });
+    double t3 = run([](void* ptr, std::vector<void*>& buffer) {
+        buffer.push_back(ptr);
+        if (buffer.size() == RETIRE_BATCH_NUM)
+        {
+            for (void* obj : buffer)
+            {
+                ConcurrentFree(obj);
+            }
+            buffer.clear();
+        }
+    });
+
+    printf("%zu个线程，%zu轮次，每轮次申请回收%zu个%zuB的节点：马上释放 %.2f ns，ConcurrentRetire %.2f ns，自己攒一批再释放 %.2f ns\n",
+        nworks, rounds, ntimes, sizeof(FixedNode), t1, t2, t3);
+}
+
+/* span着色：取size大小的块，每个span只留第一块，反复访问它们的第一个缓存行
+   不着色时这些块都在页首，落到同一个缓存组里；用 -DSPAN_COLORING=0 编译对比 */
+void BenchmarkSpanColor(size_t size, size_t spans, size_t rounds)
+{
+    std::vector<void*> all;
+    std::vector<char*> hot;
+    std::vector<size_t> sets(SPAN_COLOR_PERIOD / CACHE_LINE, 0);  // 一个周期内每个缓存行位置上有几块
+    std::set<Span*> seen;
+    while (hot.size() < spans)
+    {
+        // 新span切出来的块按地址顺序给出去，拿到的第一块就是span的第一块
+        char* ptr = (char*)ConcurrentAlloc(size);
+        all.push_back(ptr);
+        Span* span = PageCache::GetInstance()->MapObjectToSpan(ptr);
+        if (seen.insert(span).second)
+        {
+            hot.push_back(ptr);
+            ++sets[(size_t)ptr % SPAN_COLOR_PERIOD / CACHE_LINE];
+        }
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        for (char* ptr : hot)
+        {
+            ++*(volatile size_t*)ptr;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    printf("SPAN_COLORING=%d，%zuB的块，%zu个span：每次访问%.2f ns，第一块在一个周期内占了%zu个缓存行位置\n",
+        SPAN_COLORING, size, spans,
+        (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / (rounds * spans),
+        (size_t)std::count_if(sets.begin(), sets.end(), [](size_t n) { return n > 0; }));
+
+    for (void* ptr : all)
+    {
+        ConcurrentFree(ptr);
+    }
+}
+
+#ifndef _WIN32
+// 持久化分配域：重启之后从头建一遍数据结构 vs 重新映射文件直接用原来的
+struct PersistentEntry
+{
+    PersistentEntry* _next;
+    size_t _key;
+    char _value[48];
+};
+
+void BenchmarkPersistentRestart(size_t n)
+{
+    const char* path = "/tmp/ConcurrentMemoryPoolBench.heap";
+    unlink(path);
+
+    auto t0 = std::chrono::steady_clock::now();
+    SharedHeap* heap = PersistentHeapOpen(path, SizeClass::_RoundUp(n * 128 + 16 * 1024 * 1024, 1 << PAGE_SHIFT));
+    PersistentEntry* head = nullptr;
+    for (size_t i = 0; i < n; ++i)
+    {
+        PersistentEntry* entry = (PersistentEntry*)SharedHeapAlloc(heap, sizeof(PersistentEntry));
+        entry->_next = head;
+        entry->_key = i;
+        snprintf(entry->_value, sizeof(entry->_value), "value%zu", i);
+        head = entry;
+    }
+    SharedHeapSetRoot(heap, head);
+    auto t1 = std::chrono::steady_clock::now();
+    PersistentHeapClose(heap);
+    auto t2 = std::chrono::steady_clock::now();
+
+    // 重新打开，拿到根对象就能用，再遍历一遍把页读进来
+    heap = PersistentHeapOpen(path);
+    auto t3 = std::chrono::steady_clock::now();
+    size_t sum = 0;
+    for (PersistentEntry* entry = (PersistentEntry*)SharedHeapRoot(heap); entry != nullptr; entry = entry->_next)
+    {
+        sum += entry->_key + entry->_value[5];
+    }
+    auto t4 = std::chrono::steady_clock::now();
+    PersistentHeapClose(heap);
+    unlink(path);
+
+    auto ms = [](std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(b - a).count() / 1000.0;
+    };
+    printf("%zu个节点：重建%.2f ms，写回文件%.2f ms\n", n, ms(t0, t1), ms(t1, t2));
+    printf("重新打开%.3f ms，打开后遍历%.2f ms(校验和%zu)\n", ms(t2, t3), ms(t3, t4), sum);
+}
+#endif
 
 int main()
 {
+    // 启动开销，要在其他测试之前跑
+    // BenchmarkStartup();
+
     size_t n = 10000;
     cout << "--------------------------------------" << endl;
     // 内存池：4个线程，每个线程申请10万次，总计申请40万次
     BenchmarkConcurrentMalloc(n, 4, 10);
+#if LOCK_STATS
+    PrintLockStats();   // 用 -DLOCK_STATS=1 编译时打印各类锁的竞争情况
+#endif
     cout << endl << endl;
 
     // 传统malloc：4个线程，每个线程申请10万次，总计申请40万次
     BenchmarkMalloc(n, 4, 10);
     cout << "-------------------------------------" << endl;
 
+    // 单线程churn负载下的外碎片和RSS
+    // BenchmarkChurnFragmentation(100000, 20);
+
+    // 跨线程释放：一个线程申请，另一个线程释放
+    // BenchmarkCrossThreadFree(10000, 100);
+
+    // 独立请求：逐个释放 vs Heap整体销毁
+    // BenchmarkHeapRequests(100000, 20);
+
+    // 节点型容器：std::allocator vs ConcurrentAllocator
+    // BenchmarkNodeContainer(100000, 10, 4);
+
+    // 1~16MB的大块空间
+    // BenchmarkLargeAlloc(10000);
+
+    // 后台维护线程关/开时的申请尾延迟
+    // BenchmarkAllocLatency(10000, 50, 4, false);
+    // BenchmarkAllocLatency(10000, 50, 4, true);
+
+    // 自由链表冷的时候的申请速度
+    // BenchmarkColdFreeList(8, 2000);
+    // BenchmarkColdFreeList(64, 2000);
+
+    // 多MB的清零表
+    // BenchmarkCalloc(32, 20, 8 * 1024 * 1024);
+
+    // 1~64个线程下锁的扩展性
+    // BenchmarkLockScaling(100000);
+
+    // 线程空闲之后归还缓存并把空闲内存还给系统
+    // BenchmarkIdleTrim(100000, 4);
+
+    // 编译期确定大小的申请释放
+    // BenchmarkFixedSize(1000, 10000);
+
+    // 突发负载下tc和cc之间的批量移动
+    // BenchmarkBatchPolicy(100000, 5, 4);
+
+    // 按标签统计内存的开销
+    // BenchmarkTaggedAlloc(1000, 1000, 4);
+
+    // 无锁数据结构节点的延迟回收
+    // BenchmarkRetire(1000, 1000, 4);
+
+    // 不同span中同一位置的块反复访问，span着色开/关
+    // BenchmarkSpanColor(6528, 256, 10000);
+    // BenchmarkSpanColor(37888, 256, 10000);
+    // BenchmarkSpanColor(1024, 256, 10000);
+
+#ifndef _WIN32
+    // 持久化分配域：重建 vs 重新打开
+    // BenchmarkPersistentRestart(1000000);
+#endif
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,40 @@
+#!/bin/sh
+# 检查USDT探针没有改变快路径：分别用 -DALLOC_PROBES=0 和 -DALLOC_PROBES=1 编译快路径函数，比较指令数
+# 需要<sys/sdt.h>(systemtap-sdt-dev)，额外的编译参数可以放在CXXFLAGS里
+# 用法：tools/check_fast_path.sh [g++]
+CXX=${1:-g++}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# 编译期大小的申请/释放，内联之后就是tc的快路径，链表空了才调用慢路径
+cat > "$TMP/fast_path.cpp" <<'SRC'
+#include "ConcurrentAlloc.h"
+extern "C" void* FastAlloc() { return ConcurrentAlloc<32>(); }
+extern "C" void FastFree(void* ptr) { ConcurrentFree<32>(ptr); }
+extern "C" void SizedFree(void* ptr, size_t size) { ConcurrentFree(ptr, size); }
+SRC
+
+for probes in 0 1; do
+    if ! $CXX -std=c++17 -O2 -DNDEBUG -DALLOC_PROBES=$probes $CXXFLAGS -I"$ROOT" -c "$TMP/fast_path.cpp" -o "$TMP/probes$probes.o"; then
+        echo "编译失败，ALLOC_PROBES=$probes"
+        exit 2
+    fi
+done
+
+status=0
+for func in FastAlloc FastFree SizedFree; do
+    count0=$(objdump -d --no-show-raw-insn "$TMP/probes0.o" | awk -v f="<$func>:" '$2 == f {p = 1; next} p && /^$/ {exit} p' | grep -c '^ ')
+    count1=$(objdump -d --no-show-raw-insn "$TMP/probes1.o" | awk -v f="<$func>:" '$2 == f {p = 1; next} p && /^$/ {exit} p' | grep -c '^ ')
+    echo "$func: 关闭探针 $count0 条指令，打开探针 $count1 条指令"
+    if [ "$count0" != "$count1" ]; then
+        status=1
+    fi
+done
+
+if [ $status -eq 0 ]; then
+    echo "快路径的指令数没有变化"
+else
+    echo "快路径的指令数变了"
+fi
+exit $status